@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Merges the traces written by `ping --trace=FILE` and prints the critical
+path of the run together with the slack of every hop.
+
+A hop is one reliable message: its local time is the time between receiving
+the parent message (or the start of the sending node) and sending it, its
+network time is the time between the first send and the first receive,
+including retransmits. The critical path ends at the last received message
+and follows the parents back to the start. The slack of a message is how much
+later it could have arrived without delaying the end of the run. For messages
+that a node waited for as a group (all pongs, all done reports of children),
+only the last one triggered the next step, so the others have additional
+slack up to the arrival of the trigger.
+"""
+
+import argparse
+import collections
+import json
+import sys
+
+
+class Message:
+    def __init__(self, ident):
+        self.ident = ident
+        self.type = "?"
+        self.parent = ""
+        self.sent = None
+        self.received = None
+        self.retransmits = 0
+        self.children = []
+        self.finish = None
+        self.slack = None
+
+    def sender(self):
+        return self.ident.split("-")[0]
+
+    def receiver(self):
+        return self.ident.split("-")[1]
+
+
+def load(paths):
+    """Returns all messages by ID, the start time of each node, node names and
+    all join events."""
+    messages = {}
+    starts = {}
+    names = {}
+    joins = []
+
+    def get(ident):
+        if ident not in messages:
+            messages[ident] = Message(ident)
+        return messages[ident]
+
+    for path in paths:
+        node = None
+        with open(path) as f:
+            for line in f:
+                line = line.strip()
+                if not line:
+                    continue
+                ev = json.loads(line)
+                kind = ev["event"]
+                if kind == "start":
+                    node = ev["node"]
+                    starts[node] = ev["t"]
+                    names[node] = ev["name"] or node
+                elif kind == "send":
+                    msg = get(ev["id"])
+                    msg.type = ev["type"]
+                    msg.parent = ev["parent"]
+                    msg.sent = ev["t"]
+                elif kind == "retransmit":
+                    get(ev["id"]).retransmits += 1
+                elif kind == "receive":
+                    msg = get(ev["id"])
+                    msg.type = ev["type"]
+                    if not ev["duplicate"] and msg.received is None:
+                        msg.received = ev["t"]
+                elif kind == "join":
+                    joins.append((ev["id"], ev["waits"]))
+    return messages, starts, names, joins
+
+
+def compute_slack(messages, joins, end):
+    complete = [m for m in messages.values()
+                if m.sent is not None and m.received is not None]
+    for msg in complete:
+        parent = messages.get(msg.parent)
+        if parent is not None:
+            parent.children.append(msg)
+    # Process messages in reverse arrival order so that all children of a
+    # message are done before the message itself.
+    for msg in sorted(complete, key=lambda m: m.received, reverse=True):
+        msg.finish = max([msg.received] +
+                         [c.finish for c in msg.children
+                          if c.finish is not None])
+        msg.slack = end - msg.finish
+    ordered = sorted(joins, key=lambda j: messages[j[0]].received or 0,
+                     reverse=True)
+    for trigger_id, waits in ordered:
+        trigger = messages.get(trigger_id)
+        if trigger is None or trigger.slack is None:
+            continue
+        for ident in waits:
+            msg = messages.get(ident)
+            if msg is None or msg.slack is None or msg is trigger:
+                continue
+            bound = trigger.received - msg.received + trigger.slack
+            msg.slack = min(msg.slack, bound)
+    return complete
+
+
+def critical_path(messages, last):
+    path = []
+    msg = last
+    while msg is not None:
+        path.append(msg)
+        msg = messages.get(msg.parent)
+    path.reverse()
+    return path
+
+
+def ms(ns):
+    return ns / 1e6
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("traces", nargs="+",
+                        help="trace files of all nodes")
+    parser.add_argument("--top", type=int, default=10,
+                        help="number of hops with the least slack to list")
+    args = parser.parse_args()
+    messages, starts, names, joins = load(args.traces)
+    received = [m for m in messages.values()
+                if m.sent is not None and m.received is not None]
+    if not received:
+        print("no complete messages in the traces")
+        return 1
+    lost = len(messages) - len(received)
+    begin = min(starts.values())
+    last = max(received, key=lambda m: m.received)
+    end = last.received
+    compute_slack(messages, joins, end)
+    name = lambda key: names.get(key, key)
+
+    def local_time(msg):
+        parent = messages.get(msg.parent)
+        if parent is not None and parent.received is not None:
+            return msg.sent - parent.received
+        return msg.sent - starts.get(msg.sender(), begin)
+
+    path = critical_path(messages, last)
+    print("total: %.3f ms, %d messages, %d never received"
+          % (ms(end - begin), len(received), lost))
+    print()
+    print("critical path:")
+    print("  %-9s %-12s %-12s %10s %10s %4s"
+          % ("type", "from", "to", "local ms", "net ms", "rtx"))
+    totals = collections.defaultdict(lambda: [0, 0])
+    for msg in path:
+        local = local_time(msg)
+        network = msg.received - msg.sent
+        totals["local"][0] += local
+        totals["network"][0] += network
+        totals[msg.type][1] += network
+        print("  %-9s %-12s %-12s %10.3f %10.3f %4d"
+              % (msg.type, name(msg.sender()), name(msg.receiver()),
+                 ms(local), ms(network), msg.retransmits))
+    print()
+    print("on the critical path: %.3f ms local, %.3f ms network"
+          % (ms(totals["local"][0]), ms(totals["network"][0])))
+    by_type = sorted((k, v[1]) for k, v in totals.items()
+                     if k not in ("local", "network"))
+    for kind, network in by_type:
+        print("  %-9s %10.3f ms network" % (kind, ms(network)))
+    print()
+    print("hops with the least slack:")
+    print("  %-9s %-12s %-12s %10s %10s"
+          % ("type", "from", "to", "net ms", "slack ms"))
+    for msg in sorted(received, key=lambda m: m.slack)[:args.top]:
+        print("  %-9s %-12s %-12s %10.3f %10.3f"
+              % (msg.type, name(msg.sender()), name(msg.receiver()),
+                 ms(msg.received - msg.sent), ms(msg.slack)))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
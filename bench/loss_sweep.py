@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""Compares plain retransmission with XOR parity (FEC) over a range of loss
+rates.
+
+With `--pong`, the script starts a localhost ring of `pong` nodes for every
+combination of loss rate and FEC group size. Each node drops that fraction of
+its outgoing messages, parities and acks (`--drop-rate`), so the sweep
+measures the actual encoder, decoder and retransmit timers of `pong`. Nodes
+get their settings from a `caf-application.ini` in their own working
+directory, as in `run.py`.
+
+With `--simulate`, it runs the same sweep with the discrete-event simulator
+of the `ping` protocol instead.
+
+For every combination, the script runs `--seeds` times and prints the mean
+completion time, the number of runs that completed, and the mean number of
+retransmits and of messages recovered from a parity per run. For `pong`, the
+completion time is the time until the slowest node shut down. A group size of
+0 means FEC is off.
+
+With `--check`, the script exits with a non-zero status if any run did not
+complete, e.g., because lost discovery messages left a node waiting forever.
+"""
+
+import argparse
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+
+COMPLETED = re.compile(r"completed after: ([0-9.]+) ms")
+RECOVERED = re.compile(r"recovered from parity: ([0-9]+)")
+# One row per message type: name, sent, retransmit, lost, duplicate.
+ROW = re.compile(r"^(\w+)\s+(\d+)\s+(\d+)\s+(\d+)\s+(\d+)$", re.M)
+
+# Printed by each `pong` node when it shuts down.
+PONG_FINISHED = re.compile(r"\[T\] finished after ([0-9.]+) ms")
+PONG_COUNTS = re.compile(r"\[r\] retransmits = (\d+),.* recovered = (\d+)")
+
+INI_TEMPLATE = """[global]
+host="localhost"
+local-port={local_port}
+port={port}
+others={others}
+leader={leader}
+name="node{index:02d}"
+timeout={timeout}
+fec-group={group}
+drop-rate={loss}
+drop-seed={seed}
+"""
+
+
+def run_simulate(args, loss, group, seed):
+    cmd = [args.simulate, "--nodes=%d" % args.nodes, "--loss=%s" % loss,
+           "--fec-group=%d" % group, "--seed=%d" % seed]
+    out = subprocess.run(cmd, stdout=subprocess.PIPE, check=True,
+                         universal_newlines=True).stdout
+    completed = COMPLETED.search(out)
+    recovered = RECOVERED.search(out)
+    retransmits = sum(int(m.group(3)) for m in ROW.finditer(out))
+    return (float(completed.group(1)) if completed else None,
+            int(recovered.group(1)) if recovered else 0,
+            retransmits)
+
+
+def run_pong(args, loss, group, seed):
+    with tempfile.TemporaryDirectory() as workdir:
+        procs = []
+        logs = []
+        for i in range(args.nodes):
+            nodedir = os.path.join(workdir, "node{:02d}".format(i))
+            os.makedirs(nodedir)
+            with open(os.path.join(nodedir, "caf-application.ini"), "w") as f:
+                f.write(INI_TEMPLATE.format(
+                    local_port=args.base_port + i,
+                    port=args.base_port + (i + 1) % args.nodes,
+                    others=args.nodes - 1,
+                    leader="true" if i == 0 else "false",
+                    index=i,
+                    timeout=args.timeout,
+                    group=group,
+                    loss=loss,
+                    seed=seed))
+            log = os.path.join(nodedir, "out.txt")
+            with open(log, "w") as out:
+                procs.append(subprocess.Popen(
+                    [args.pong, "--offset={}".format(args.offset)],
+                    cwd=nodedir, stdout=out, stderr=subprocess.STDOUT))
+            logs.append(log)
+        failed = False
+        for p in procs:
+            try:
+                failed |= p.wait(timeout=args.deadline) != 0
+            except subprocess.TimeoutExpired:
+                p.kill()
+                p.wait()
+                failed = True
+        times = []
+        retransmits = 0
+        recovered = 0
+        for log in logs:
+            with open(log) as f:
+                out = f.read()
+            finished = PONG_FINISHED.search(out)
+            counts = PONG_COUNTS.search(out)
+            if finished:
+                times.append(float(finished.group(1)))
+            if counts:
+                retransmits += int(counts.group(1))
+                recovered += int(counts.group(2))
+    done = not failed and len(times) == args.nodes
+    return (max(times) if done else None, recovered, retransmits)
+
+
+def sweep(args, run):
+    """Prints one row per combination and returns the number of runs that
+    did not complete."""
+    incomplete = 0
+    print("%-6s %-6s %12s %6s %12s %10s"
+          % ("loss", "group", "complete ms", "runs", "retransmits",
+             "recovered"))
+    for loss in args.losses.split(","):
+        for group in (int(x) for x in args.groups.split(",")):
+            results = [run(args, loss, group, seed)
+                       for seed in range(args.seeds)]
+            times = [r[0] for r in results if r[0] is not None]
+            incomplete += args.seeds - len(times)
+            mean_time = statistics.mean(times) if times else float("nan")
+            print("%-6s %-6d %12.1f %3d/%-2d %12.1f %10.1f"
+                  % (loss, group, mean_time, len(times), args.seeds,
+                     statistics.mean(r[2] for r in results),
+                     statistics.mean(r[1] for r in results)))
+            sys.stdout.flush()
+    return incomplete
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--pong", default="",
+                        help="path to the pong executable")
+    parser.add_argument("--simulate", default="",
+                        help="path to the simulate executable")
+    parser.add_argument("--nodes", type=int, default=8)
+    parser.add_argument("--losses", default="0,0.01,0.02,0.05,0.1",
+                        help="comma-separated loss rates")
+    parser.add_argument("--groups", default="0,2,4,8",
+                        help="comma-separated FEC group sizes")
+    parser.add_argument("--seeds", type=int, default=5)
+    parser.add_argument("--base-port", type=int, default=12400)
+    parser.add_argument("--offset", type=int, default=0,
+                        help="shift all ports of pong nodes")
+    parser.add_argument("--timeout", type=int, default=2,
+                        help="seconds pong waits before connecting and "
+                             "before exiting")
+    parser.add_argument("--deadline", type=int, default=120,
+                        help="seconds before a pong node is killed")
+    parser.add_argument("--check", action="store_true",
+                        help="fail if any run did not complete")
+    args = parser.parse_args()
+    if not args.pong and not args.simulate:
+        parser.error("need --pong or --simulate")
+    incomplete = 0
+    if args.pong:
+        print("pong, %d nodes" % args.nodes)
+        incomplete += sweep(args, run_pong)
+    if args.simulate:
+        if args.pong:
+            print()
+        print("simulate, %d nodes" % args.nodes)
+        incomplete += sweep(args, run_simulate)
+    if args.check and incomplete > 0:
+        print("%d runs did not complete" % incomplete)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,341 @@
+#!/usr/bin/env python3
+"""Runs the `count` scenario on a localhost cluster and compares the results
+with a stored baseline.
+
+Each node gets its own working directory with a `caf-application.ini` (like
+the `nodeXX` directories), listens on `base-port + i` and connects to the
+next node in the ring. `--offset` shifts all ports, so several benchmark runs
+can share a host. The script exits with a non-zero status if any metric
+regressed by more than `--tolerance` relative to the baseline, or if there is
+no baseline and neither `--update-baseline` nor `--init-baseline` is given.
+`--init-baseline` records a missing baseline instead of failing, so the first
+run on a new machine succeeds and later runs compare against it.
+
+With `--warm-restart`, the cluster runs twice in the same directories and the
+second run starts from the peer caches of the first. `--stale-entries=N` adds
+N contacts per node to the caches before the restart that point to ports
+where no node listens, like a node that has left the cluster. The summary
+describes the second run, and `restart_wall_ms` is the time until all of its
+nodes exited.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# Metrics where smaller values are better.
+LOWER_IS_BETTER = ["connect_ms", "share_ms", "rtt_p50_us", "rtt_p90_us",
+                   "rtt_p99_us", "syscalls_per_msg", "restart_wall_ms"]
+
+# Metrics where larger values are better.
+HIGHER_IS_BETTER = ["throughput_msgs_per_sec"]
+
+INI_TEMPLATE = """[global]
+host="localhost"
+local-port={local_port}
+port={port}
+others={others}
+leader={leader}
+name="node{index:02d}"
+timeout={timeout}
+rounds={rounds}
+ci-target={ci_target}
+prewarm={prewarm}
+results="{results}"
+cpus="{cpus}"
+io-cpus="{io_cpus}"
+perf-results="{perf_results}"
+window={window}
+pace-rate={pace_rate}
+peer-cache="{peer_cache}"
+
+[middleman]
+enable-udp={udp}
+enable-tcp={tcp}
+{middleman_extra}"""
+
+
+def cpu_range(args, node, slot):
+    """Returns the CPUs for the scheduler (`slot` 0) or the middleman (`slot`
+    1) of a node. With `--cpus-per-node=k`, node i owns CPUs i*k to i*k+k-1
+    and the last of them is reserved for the middleman if k > 1."""
+    k = args.cpus_per_node
+    if k == 0:
+        return ""
+    first = node * k
+    last = first + k - 1
+    if k == 1:
+        return str(first)
+    if slot == 0:
+        return "{}-{}".format(first, last - 1) if last - 1 > first \
+            else str(first)
+    return str(last)
+
+
+def middleman_extra(args):
+    """Returns additional [middleman] settings for the node configs."""
+    lines = ""
+    if args.max_consecutive_reads > 0:
+        lines += "max-consecutive-reads={}\n".format(
+            args.max_consecutive_reads)
+    return lines
+
+
+def add_stale_entries(args, workdir):
+    """Appends `--stale-entries` contacts to the peer cache of every node.
+    Their ports follow the ports of the cluster, so nobody answers there."""
+    for i in range(args.nodes):
+        path = os.path.join(workdir, "node{:02d}".format(i), "peers.txt")
+        with open(path, "a") as f:
+            for j in range(args.stale_entries):
+                port = args.base_port + args.offset + args.nodes + j
+                f.write("stale{:02d} localhost {} stale 0\n".format(j, port))
+
+
+def run_cluster(args, workdir):
+    """Runs all nodes in `workdir` and collects their results. A second call
+    with the same `workdir` reuses the node directories and peer caches."""
+    procs = []
+    results = []
+    for i in range(args.nodes):
+        nodedir = os.path.join(workdir, "node{:02d}".format(i))
+        os.makedirs(nodedir, exist_ok=True)
+        result_file = os.path.join(nodedir, "results.json")
+        perf_file = os.path.join(nodedir, "perf.json") if args.perf else ""
+        # Results of an earlier run must not stand in for missing ones.
+        for path in (result_file, os.path.join(nodedir, "perf.json")):
+            if os.path.exists(path):
+                os.remove(path)
+        with open(os.path.join(nodedir, "caf-application.ini"), "w") as f:
+            f.write(INI_TEMPLATE.format(
+                local_port=args.base_port + i,
+                port=args.base_port + (i + 1) % args.nodes,
+                others=args.nodes - 1,
+                leader="true" if i == 0 else "false",
+                index=i,
+                timeout=args.timeout,
+                rounds=args.rounds,
+                ci_target=args.ci_target,
+                prewarm="true" if args.prewarm else "false",
+                results=result_file,
+                perf_results=perf_file,
+                window=args.window,
+                pace_rate=args.pace_rate,
+                peer_cache=os.path.join(nodedir, "peers.txt")
+                if args.warm_restart else "",
+                cpus=cpu_range(args, i, 0),
+                io_cpus=cpu_range(args, i, 1),
+                udp="true" if args.udp else "false",
+                tcp="false" if args.udp else "true",
+                middleman_extra=middleman_extra(args)))
+        log = open(os.path.join(nodedir, "out.txt"), "w")
+        procs.append(subprocess.Popen(
+            [args.binary, "--offset={}".format(args.offset)],
+            cwd=nodedir, stdout=log, stderr=subprocess.STDOUT))
+        results.append(result_file)
+    failed = False
+    for i, p in enumerate(procs):
+        try:
+            if p.wait(timeout=args.deadline) != 0:
+                print("node{:02d} exited with {}".format(i, p.returncode))
+                failed = True
+        except subprocess.TimeoutExpired:
+            p.kill()
+            print("node{:02d} did not finish in time".format(i))
+            failed = True
+    nodes = []
+    for i, path in enumerate(results):
+        if not os.path.exists(path):
+            print("missing results: " + path)
+            failed = True
+            continue
+        with open(path) as f:
+            node = json.load(f)
+        perf_path = os.path.join(os.path.dirname(path), "perf.json")
+        if os.path.exists(perf_path):
+            with open(perf_path) as f:
+                node["perf"] = json.load(f)["phases"]
+        node["placement"] = {"cpus": cpu_range(args, i, 0),
+                             "io_cpus": cpu_range(args, i, 1)}
+        nodes.append(node)
+    return nodes, failed
+
+
+def summarize(nodes):
+    """Combines per-node results into one set of cluster-wide metrics."""
+    summary = {}
+    for key in LOWER_IS_BETTER:
+        # The slowest node determines when the cluster is ready.
+        if all(key in n for n in nodes):
+            summary[key] = max(n[key] for n in nodes)
+    for key in HIGHER_IS_BETTER:
+        summary[key] = sum(n[key] for n in nodes)
+    summary["rtt_p50_us_median_node"] = statistics.median(
+        n["rtt_p50_us"] for n in nodes)
+    # Informational only: a lossless baseline would flag any loss.
+    if all("loss_rate" in n for n in nodes):
+        summary["loss_rate"] = max(n["loss_rate"] for n in nodes)
+        summary["measure_ms"] = max(n["measure_ms"] for n in nodes)
+    if all("active_ms" in n for n in nodes):
+        summary["active_ms"] = max(n["active_ms"] for n in nodes)
+    if all("first_rtt_p50_us" in n for n in nodes):
+        summary["first_rtt_p50_us"] = statistics.median(
+            n["first_rtt_p50_us"] for n in nodes)
+        summary["first_rtt_max_us"] = max(n["first_rtt_max_us"]
+                                          for n in nodes)
+    if all("connect_retries" in n for n in nodes):
+        summary["connect_retries"] = sum(n["connect_retries"] for n in nodes)
+    if all("ready_ms" in n for n in nodes):
+        summary["ready_ms"] = max(n["ready_ms"] for n in nodes)
+    if all("rounds" in n for n in nodes):
+        summary["rounds"] = max(n["rounds"] for n in nodes)
+    per_msg = [syscalls_per_msg(n) for n in nodes]
+    if per_msg and None not in per_msg:
+        summary["syscalls_per_msg"] = max(per_msg)
+    return summary
+
+
+def syscalls_per_msg(node):
+    """Returns the syscalls per message a node needed while measuring or None
+    if the syscall counter was unavailable. Each ping and pong counts once on
+    the sending and once on the receiving node."""
+    syscalls = node.get("perf", {}).get("measure", {}).get("syscalls")
+    msgs = node["pings_sent"] + 2 * node["pings_received"] + node["pongs"]
+    if syscalls is None or msgs == 0:
+        return None
+    return syscalls / float(msgs)
+
+
+def compare(summary, baseline, tolerance):
+    regressions = []
+    for key in LOWER_IS_BETTER + HIGHER_IS_BETTER:
+        if key not in baseline or key not in summary:
+            continue
+        old = baseline[key]
+        new = summary[key]
+        if key in LOWER_IS_BETTER:
+            bad = new > old * (1. + tolerance)
+        else:
+            bad = new < old * (1. - tolerance)
+        print("{:28} baseline = {:12.2f}  current = {:12.2f}{}".format(
+            key, old, new, "  REGRESSION" if bad else ""))
+        if bad:
+            regressions.append(key)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--binary", required=True,
+                        help="path to the count executable")
+    parser.add_argument("--baseline", required=True,
+                        help="JSON file with the baseline results")
+    parser.add_argument("--output", default="bench-results.json",
+                        help="where to store the results of this run")
+    parser.add_argument("--nodes", type=int, default=4)
+    parser.add_argument("--rounds", type=int, default=20)
+    parser.add_argument("--ci-target", type=float, default=0.,
+                        help="let nodes stop once the 95%% CI of their mean "
+                             "RTT is within this fraction of the mean; "
+                             "--rounds becomes the maximum")
+    parser.add_argument("--timeout", type=int, default=2,
+                        help="seconds each phase waits for all nodes")
+    parser.add_argument("--base-port", type=int, default=12340)
+    parser.add_argument("--offset", type=int, default=1000)
+    parser.add_argument("--tolerance", type=float, default=0.25,
+                        help="allowed relative regression per metric")
+    parser.add_argument("--deadline", type=int, default=120,
+                        help="seconds until a node is considered hung")
+    parser.add_argument("--tcp", dest="udp", action="store_false",
+                        help="use TCP instead of UDP")
+    parser.add_argument("--cpus-per-node", type=int, default=0,
+                        help="pin each node to its own block of CPUs")
+    parser.add_argument("--max-consecutive-reads", type=int, default=0,
+                        help="datagrams/reads the middleman handles per "
+                             "socket event (0 = CAF default)")
+    parser.add_argument("--window", type=int, default=0,
+                        help="initial congestion window per node "
+                             "(0 = unlimited)")
+    parser.add_argument("--pace-rate", type=int, default=0,
+                        help="pings per second each node may send "
+                             "(0 = unlimited)")
+    parser.add_argument("--prewarm", action="store_true",
+                        help="connect to peers as soon as they are shared")
+    parser.add_argument("--perf", action="store_true",
+                        help="record performance counters per phase")
+    parser.add_argument("--warm-restart", action="store_true",
+                        help="run the cluster twice and measure the second "
+                             "run, which starts from the peer caches")
+    parser.add_argument("--stale-entries", type=int, default=0,
+                        help="unreachable contacts to add to each peer cache "
+                             "before a warm restart")
+    parser.add_argument("--update-baseline", action="store_true",
+                        help="store this run as the new baseline")
+    parser.add_argument("--init-baseline", action="store_true",
+                        help="store this run as the baseline if there is "
+                             "none yet")
+    args = parser.parse_args()
+    if args.init_baseline and not os.path.exists(args.baseline):
+        print("no baseline at {}, recording this run as the baseline".format(
+            args.baseline))
+        args.update_baseline = True
+    if not args.update_baseline and not os.path.exists(args.baseline):
+        print("no baseline at {}, record one with --update-baseline".format(
+            args.baseline))
+        return 1
+    if args.stale_entries > 0 and not args.warm_restart:
+        print("--stale-entries requires --warm-restart")
+        return 1
+    with tempfile.TemporaryDirectory(prefix="caf-bench-") as workdir:
+        nodes, failed = run_cluster(args, workdir)
+        if args.warm_restart and not failed:
+            add_stale_entries(args, workdir)
+            restart_begin = time.monotonic()
+            nodes, failed = run_cluster(args, workdir)
+            restart_wall_ms = (time.monotonic() - restart_begin) * 1000.
+    if failed or not nodes:
+        print("benchmark run failed")
+        return 1
+    summary = summarize(nodes)
+    summary["nodes"] = args.nodes
+    summary["transport"] = "udp" if args.udp else "tcp"
+    summary["cpus_per_node"] = args.cpus_per_node
+    summary["max_consecutive_reads"] = args.max_consecutive_reads
+    summary["window"] = args.window
+    summary["pace_rate"] = args.pace_rate
+    summary["prewarm"] = args.prewarm
+    summary["warm_restart"] = args.warm_restart
+    summary["stale_entries"] = args.stale_entries
+    if args.warm_restart:
+        summary["restart_wall_ms"] = restart_wall_ms
+    with open(args.output, "w") as f:
+        json.dump({"summary": summary, "nodes": nodes}, f, indent=2)
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(summary, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("stored new baseline in " + args.baseline)
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    if baseline.get("nodes") != args.nodes or \
+       baseline.get("transport") != summary["transport"] or \
+       baseline.get("cpus_per_node", 0) != args.cpus_per_node or \
+       baseline.get("warm_restart", False) != args.warm_restart or \
+       baseline.get("stale_entries", 0) != args.stale_entries:
+        print("baseline was recorded with a different setup")
+        return 1
+    regressions = compare(summary, baseline, args.tolerance)
+    if regressions:
+        print("regressed: " + ", ".join(regressions))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,44 @@
+#ifndef ACK_LANE_HPP
+#define ACK_LANE_HPP
+
+#include <cstdint>
+
+#include <caf/actor_system.hpp>
+#include <caf/message_priority.hpp>
+#include <caf/spawn_options.hpp>
+
+#include "protocol.hpp"
+
+// -----------------------------------------------------------------------------
+//  ACK LANE
+// -----------------------------------------------------------------------------
+
+// Acks of the reliable protocols travel as separate `ack_msg` values instead
+// of responses to requests, because a response inherits the priority of the
+// request. On the high-priority lane, an ack overtakes the bulk traffic
+// queued at a receiver with a priority-aware mailbox, so the sender does not
+// time out and retransmit only because the ack waited behind other messages.
+// `pong`, `ping` and `simple` share this path.
+
+/// Acknowledges message `seq` to `dest`, on the high-priority lane if
+/// `priority_lane`.
+template <class Self, class Handle>
+void send_ack(Self* self, const Handle& dest, uint32_t seq,
+              bool priority_lane) {
+  if (priority_lane)
+    self->template send<caf::message_priority::high>(dest, ack_msg{seq});
+  else
+    self->send(dest, ack_msg{seq});
+}
+
+/// Spawns `fun` with a mailbox that serves high-priority messages first if
+/// `priority_lane`, with a regular mailbox otherwise.
+template <class F, class... Ts>
+auto spawn_with_lane(caf::actor_system& sys, bool priority_lane, F fun,
+                     const Ts&... xs) -> decltype(sys.spawn(fun, xs...)) {
+  if (priority_lane)
+    return sys.spawn<caf::priority_aware>(fun, xs...);
+  return sys.spawn(fun, xs...);
+}
+
+#endif // ACK_LANE_HPP
@@ -0,0 +1,78 @@
+#ifndef BACKOFF_HPP
+#define BACKOFF_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <thread>
+
+// -----------------------------------------------------------------------------
+//  RETRIES WITH BACKOFF
+// -----------------------------------------------------------------------------
+
+/// Exponential backoff with jitter. The n-th wait is drawn uniformly from
+/// [d/2, d] with d = min(max, initial * 2^n), so nodes that started together
+/// do not retry in lockstep, but never retry right away either.
+class backoff {
+public:
+  using clock = std::chrono::steady_clock;
+
+  backoff(clock::duration initial, clock::duration max, uint64_t seed)
+      : initial_(initial),
+        max_(std::max(initial, max)),
+        attempts_(0),
+        gen_(seed) {
+    // nop
+  }
+
+  /// Returns the time to wait before the next attempt.
+  clock::duration next() {
+    auto d = initial_;
+    for (uint32_t i = 0; i < attempts_ && d < max_; ++i)
+      d *= 2;
+    d = std::min(d, max_);
+    ++attempts_;
+    std::uniform_int_distribution<clock::rep> jitter{d.count() / 2, d.count()};
+    return clock::duration{jitter(gen_)};
+  }
+
+  /// Returns how often `next` was called. After a successful `retry`, this
+  /// is the number of retries.
+  uint32_t attempts() const {
+    return attempts_;
+  }
+
+private:
+  clock::duration initial_;
+  clock::duration max_;
+  uint32_t attempts_;
+  std::minstd_rand gen_;
+};
+
+/// Calls `f` until it returns a value that converts to `true`, the next
+/// attempt would start after `deadline` or another thread sets `cancel`.
+/// Waits in steps of at most 10ms, so a cancel takes effect quickly even
+/// during long backoffs. Returns the last result.
+template <class F>
+auto retry(F f, backoff& b, backoff::clock::time_point deadline,
+           const std::atomic<bool>& cancel) -> decltype(f()) {
+  auto x = f();
+  while (!x && !cancel) {
+    auto until = backoff::clock::now() + b.next();
+    if (until >= deadline)
+      break;
+    for (auto now = backoff::clock::now(); now < until && !cancel;
+         now = backoff::clock::now())
+      std::this_thread::sleep_for(
+        std::min<backoff::clock::duration>(until - now,
+                                           std::chrono::milliseconds(10)));
+    if (cancel)
+      break;
+    x = f();
+  }
+  return x;
+}
+
+#endif // BACKOFF_HPP
@@ -0,0 +1,86 @@
+#ifndef CLOCK_OFFSET_HPP
+#define CLOCK_OFFSET_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// -----------------------------------------------------------------------------
+//  CLOCK OFFSET ESTIMATION
+// -----------------------------------------------------------------------------
+
+/// Returns the local wall clock in nanoseconds. Only differences between two
+/// readings or offset-corrected readings of different nodes are meaningful.
+inline int64_t clock_now() {
+  using namespace std::chrono;
+  auto t = system_clock::now().time_since_epoch();
+  return duration_cast<nanoseconds>(t).count();
+}
+
+/// Estimates the offset of a remote clock relative to the local clock from
+/// NTP-style probes. Each probe consists of four timestamps: `t0` (local
+/// send), `t1` (remote receive), `t2` (remote send) and `t3` (local receive).
+/// The estimate uses the probe with the smallest round-trip time, because it
+/// suffered the least queueing. The true offset lies within `offset() +/-
+/// error()` as long as the clocks do not drift noticeably during a run.
+class clock_offset {
+public:
+  clock_offset()
+      : offset_(0),
+        rtt_(std::numeric_limits<int64_t>::max()),
+        samples_(0) {
+    // nop
+  }
+
+  void add(int64_t t0, int64_t t1, int64_t t2, int64_t t3) {
+    ++samples_;
+    auto rtt = (t3 - t0) - (t2 - t1);
+    if (rtt < 0 || rtt >= rtt_)
+      return;
+    rtt_ = rtt;
+    offset_ = ((t1 - t0) + (t2 - t3)) / 2;
+  }
+
+  bool valid() const {
+    return rtt_ != std::numeric_limits<int64_t>::max();
+  }
+
+  /// Remote clock minus local clock in nanoseconds.
+  int64_t offset() const {
+    return offset_;
+  }
+
+  /// Upper bound for the error of `offset()` in nanoseconds.
+  int64_t error() const {
+    return valid() ? rtt_ / 2 : 0;
+  }
+
+  /// Smallest observed round-trip time in nanoseconds.
+  int64_t min_rtt() const {
+    return rtt_;
+  }
+
+  size_t samples() const {
+    return samples_;
+  }
+
+  /// Delay from the local node to the remote node for a message sent at
+  /// local time `sent` and received at remote time `received`.
+  int64_t forward_delay(int64_t sent, int64_t received) const {
+    return received - offset_ - sent;
+  }
+
+  /// Delay from the remote node to the local node for a message sent at
+  /// remote time `sent` and received at local time `received`.
+  int64_t return_delay(int64_t sent, int64_t received) const {
+    return received - (sent - offset_);
+  }
+
+private:
+  int64_t offset_;
+  int64_t rtt_;
+  size_t samples_;
+};
+
+#endif // CLOCK_OFFSET_HPP
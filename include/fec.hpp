@@ -0,0 +1,103 @@
+#ifndef FEC_HPP
+#define FEC_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+//  FORWARD ERROR CORRECTION
+// -----------------------------------------------------------------------------
+
+// XOR parity over groups of consecutive reliable messages to the same node.
+// The sender XORs the serialized messages of a group and sends the result
+// after the last one. If exactly one message of the group got lost, the
+// receiver XORs the parity with the messages it got and obtains the missing
+// one without waiting for the retransmit timeout. Each payload enters the
+// parity with a 4-byte length prefix and zero padding, so messages of
+// different sizes can share a group.
+
+/// Accumulates the parity of one group.
+class fec_encoder {
+public:
+  fec_encoder() : count_(0) {
+    // nop
+  }
+
+  void add(const std::vector<char>& payload) {
+    xor_into(parity_, payload);
+    ++count_;
+  }
+
+  /// Returns the number of payloads in the current group.
+  uint32_t count() const {
+    return count_;
+  }
+
+  /// Returns the parity of the current group and starts a new one.
+  std::vector<char> take() {
+    std::vector<char> result;
+    result.swap(parity_);
+    count_ = 0;
+    return result;
+  }
+
+  /// XORs `payload` with its length prefix into `parity`.
+  static void xor_into(std::vector<char>& parity,
+                       const std::vector<char>& payload) {
+    auto n = static_cast<uint32_t>(payload.size());
+    if (parity.size() < payload.size() + 4)
+      parity.resize(payload.size() + 4, 0);
+    for (size_t i = 0; i < 4; ++i)
+      parity[i] ^= static_cast<char>((n >> (8 * i)) & 0xFF);
+    for (size_t i = 0; i < payload.size(); ++i)
+      parity[i + 4] ^= payload[i];
+  }
+
+private:
+  std::vector<char> parity_;
+  uint32_t count_;
+};
+
+/// Keeps the payloads received from one node until the parity of their
+/// group arrived.
+class fec_decoder {
+public:
+  void add(uint32_t seq, std::vector<char> payload) {
+    payloads_[seq] = std::move(payload);
+  }
+
+  /// Rebuilds the single missing message of the group `[first, first +
+  /// count)`. Returns `false` if no message or more than one message is
+  /// missing. Forgets all payloads of this and earlier groups in any case.
+  bool recover(uint32_t first, uint32_t count, std::vector<char> parity,
+               uint32_t& seq, std::vector<char>& payload) {
+    auto missing = count;
+    for (auto i = first; i < first + count; ++i) {
+      auto j = payloads_.find(i);
+      if (j == payloads_.end()) {
+        seq = i;
+        continue;
+      }
+      fec_encoder::xor_into(parity, j->second);
+      --missing;
+    }
+    payloads_.erase(payloads_.begin(), payloads_.lower_bound(first + count));
+    if (missing != 1 || parity.size() < 4)
+      return false;
+    uint32_t n = 0;
+    for (size_t i = 0; i < 4; ++i)
+      n |= static_cast<uint32_t>(static_cast<unsigned char>(parity[i]))
+           << (8 * i);
+    if (n > parity.size() - 4)
+      return false;
+    payload.assign(parity.begin() + 4, parity.begin() + 4 + n);
+    return true;
+  }
+
+private:
+  std::map<uint32_t, std::vector<char>> payloads_;
+};
+
+#endif // FEC_HPP
@@ -0,0 +1,612 @@
+#ifndef LOCAL_TRANSPORT_HPP
+#define LOCAL_TRANSPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "shm_ring.hpp"
+
+// -----------------------------------------------------------------------------
+//  TRANSPORTS BETWEEN CO-LOCATED NODES
+// -----------------------------------------------------------------------------
+
+enum class transport_kind {
+  shm,
+  udp,
+  udp_batch,
+  tcp
+};
+
+inline const char* to_string(transport_kind x) {
+  switch (x) {
+    case transport_kind::shm:
+      return "shm";
+    case transport_kind::udp:
+      return "udp";
+    case transport_kind::udp_batch:
+      return "mmsg";
+    default:
+      return "tcp";
+  }
+}
+
+/// Returns whether `host` names this machine.
+inline bool is_local_host(const std::string& host) {
+  if (host == "localhost" || host == "::1" || host.compare(0, 4, "127.") == 0)
+    return true;
+  char name[256];
+  if (gethostname(name, sizeof(name)) != 0)
+    return false;
+  name[sizeof(name) - 1] = '\0';
+  return host == name;
+}
+
+/// Picks shared memory for nodes on the same host and the configured socket
+/// transport otherwise.
+inline transport_kind choose_transport(const std::string& host, bool udp) {
+  if (is_local_host(host))
+    return transport_kind::shm;
+  return udp ? transport_kind::udp : transport_kind::tcp;
+}
+
+/// Which end of a link a process opens when the two ends live in different
+/// processes. The `listen` end creates the shared memory segments or accepts
+/// the TCP connection, the `connect` end attaches to it.
+enum class link_side {
+  listen,
+  connect
+};
+
+/// A bidirectional message channel between two endpoints.
+class local_link {
+public:
+  virtual ~local_link() {
+    // nop
+  }
+
+  /// Sends `len` bytes as one message.
+  virtual bool send(const char* buf, size_t len) = 0;
+
+  /// Blocks until a message arrives and returns its size, or returns 0 after
+  /// about a second without a message. `buf` must hold `max_message_size`
+  /// bytes.
+  virtual size_t receive(char* buf) = 0;
+
+  /// Sends all messages that `send` buffered. Links that do not buffer send
+  /// right away.
+  virtual void flush() {
+    // nop
+  }
+
+  /// Returns how many syscalls this link made so far. Safe to call from
+  /// another thread than the one using the link.
+  uint64_t syscalls() const {
+    return syscalls_.load(std::memory_order_relaxed);
+  }
+
+  static constexpr size_t max_message_size = 16384;
+
+protected:
+  void count_syscall() {
+    syscalls_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> syscalls_{0};
+};
+
+/// Two rings, one per direction. Both sides poll and yield when idle.
+class shm_link : public local_link {
+public:
+  bool send(const char* buf, size_t len) override {
+    while (!tx_.try_write(buf, len)) {
+      count_syscall();
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  size_t receive(char* buf) override {
+    using clock = std::chrono::steady_clock;
+    auto until = clock::now() + std::chrono::seconds(1);
+    for (size_t i = 0;; ++i) {
+      auto len = rx_.try_read(buf);
+      if (len > 0)
+        return len;
+      // Spin a little before giving up the CPU, a reply is often only a few
+      // hundred nanoseconds away.
+      if (i >= 1000) {
+        if (clock::now() >= until)
+          return 0;
+        count_syscall();
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  ~shm_link() override {
+    // Removes the segments in case no other process ever attached.
+    tx_.unlink();
+    rx_.unlink();
+  }
+
+  /// Creates the segments `name-a` and `name-b` for a peer that attaches
+  /// with `attach`, in this process or another one on the same host.
+  static std::unique_ptr<local_link> create(const std::string& name,
+                                            size_t capacity) {
+    auto x = new shm_link;
+    std::unique_ptr<local_link> result{x};
+    if (!x->tx_.create(name + "-a", capacity)
+        || !x->rx_.create(name + "-b", capacity))
+      return nullptr;
+    return result;
+  }
+
+  /// Attaches to the segments of `create` with swapped roles. Returns
+  /// `nullptr` if they do not exist yet.
+  static std::unique_ptr<local_link> attach(const std::string& name) {
+    auto x = new shm_link;
+    std::unique_ptr<local_link> result{x};
+    if (!x->rx_.open(name + "-a") || !x->tx_.open(name + "-b"))
+      return nullptr;
+    // The mappings stay valid, the names are only needed for attaching.
+    x->rx_.unlink();
+    x->tx_.unlink();
+    return result;
+  }
+
+  /// Returns a connected pair of links in this process.
+  static bool make_pair(const std::string& name, size_t capacity,
+                        std::unique_ptr<local_link>& x,
+                        std::unique_ptr<local_link>& y) {
+    x = create(name, capacity);
+    y = x ? attach(name) : nullptr;
+    return x && y;
+  }
+
+private:
+  shm_ring tx_;
+  shm_ring rx_;
+};
+
+/// Base for links over a connected socket.
+class socket_link : public local_link {
+public:
+  explicit socket_link(int fd) : fd_(fd) {
+    timeval tv{1, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  }
+
+  ~socket_link() override {
+    close(fd_);
+  }
+
+protected:
+  static sockaddr_in loopback(uint16_t port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+  }
+
+  static sockaddr* as_sockaddr(sockaddr_in& addr) {
+    return reinterpret_cast<sockaddr*>(&addr);
+  }
+
+  int fd_;
+};
+
+/// One datagram per message, like the UDP transport of the middleman.
+class udp_link : public socket_link {
+public:
+  using socket_link::socket_link;
+
+  bool send(const char* buf, size_t len) override {
+    count_syscall();
+    return ::send(fd_, buf, len, 0) == static_cast<ssize_t>(len);
+  }
+
+  size_t receive(char* buf) override {
+    count_syscall();
+    auto res = recv(fd_, buf, max_message_size, 0);
+    return res > 0 ? static_cast<size_t>(res) : 0;
+  }
+
+  /// Returns one end of a link over loopback. The `listen` end binds to
+  /// `port` and sends to `port + 1`, the `connect` end the other way around.
+  static std::unique_ptr<local_link> open(uint16_t port, link_side side) {
+    auto fd = connected_socket(port, side);
+    return std::unique_ptr<local_link>{fd >= 0 ? new udp_link(fd) : nullptr};
+  }
+
+  /// Returns a pair of links over loopback on `port` and `port + 1`.
+  static bool make_pair(uint16_t port, std::unique_ptr<local_link>& x,
+                        std::unique_ptr<local_link>& y) {
+    x = open(port, link_side::listen);
+    y = x ? open(port, link_side::connect) : nullptr;
+    return x && y;
+  }
+
+protected:
+  /// Returns a socket bound to the local port of `side` and connected to the
+  /// port of the other side, or -1.
+  static int connected_socket(uint16_t port, link_side side) {
+    auto other = static_cast<uint16_t>(port + 1);
+    if (side == link_side::connect)
+      std::swap(port, other);
+    auto fd = bound(port);
+    if (fd >= 0 && !connect_to(fd, other)) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static int bound(uint16_t port) {
+    auto fd = socket(AF_INET, SOCK_DGRAM, 0);
+    auto addr = loopback(port);
+    if (fd >= 0 && bind(fd, as_sockaddr(addr), sizeof(addr)) != 0) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static bool connect_to(int fd, int port) {
+    auto addr = loopback(static_cast<uint16_t>(port));
+    return connect(fd, as_sockaddr(addr), sizeof(addr)) == 0;
+  }
+};
+
+#ifdef __linux__
+/// Like `udp_link`, but moves up to `batch_size` datagrams per syscall.
+/// `send` only queues a message. The queue goes out with one `sendmmsg` once
+/// it holds `batch_size` messages, once its oldest message waited for
+/// `flush_interval` at the next `send`, or before the next `receive`.
+/// `receive` fetches all waiting datagrams, up to `batch_size`, with one
+/// `recvmmsg` and hands them out one by one.
+class udp_batch_link : public udp_link {
+public:
+  using clock = std::chrono::steady_clock;
+
+  udp_batch_link(int fd, size_t batch_size, clock::duration flush_interval)
+      : udp_link(fd),
+        batch_size_(std::max(batch_size, size_t{1})),
+        flush_interval_(flush_interval),
+        tx_(batch_size_),
+        rx_(batch_size_),
+        tx_count_(0),
+        rx_count_(0),
+        rx_next_(0) {
+    // nop
+  }
+
+  ~udp_batch_link() override {
+    flush();
+  }
+
+  bool send(const char* buf, size_t len) override {
+    if (len > max_message_size)
+      return false;
+    auto now = clock::now();
+    if (tx_count_ == 0)
+      tx_first_ = now;
+    memcpy(tx_.data(tx_count_), buf, len);
+    tx_.set_length(tx_count_++, len);
+    if (tx_count_ < batch_size_ && now - tx_first_ < flush_interval_)
+      return true;
+    return send_batch();
+  }
+
+  size_t receive(char* buf) override {
+    send_batch();
+    if (rx_next_ == rx_count_) {
+      rx_next_ = 0;
+      rx_count_ = 0;
+      count_syscall();
+      auto res = recvmmsg(fd_, rx_.headers(),
+                          static_cast<unsigned>(batch_size_), MSG_WAITFORONE,
+                          nullptr);
+      if (res <= 0)
+        return 0;
+      rx_count_ = static_cast<size_t>(res);
+    }
+    auto i = rx_next_++;
+    auto len = rx_.received(i);
+    memcpy(buf, rx_.data(i), len);
+    return len;
+  }
+
+  void flush() override {
+    send_batch();
+  }
+
+  /// Returns one end of a link over loopback, using the ports like
+  /// `udp_link::open`.
+  static std::unique_ptr<local_link> open(uint16_t port, link_side side,
+                                          size_t batch_size,
+                                          clock::duration flush_interval) {
+    auto fd = connected_socket(port, side);
+    if (fd < 0)
+      return nullptr;
+    return std::unique_ptr<local_link>{
+      new udp_batch_link(fd, batch_size, flush_interval)};
+  }
+
+  /// Returns a pair of links over loopback on `port` and `port + 1`.
+  static bool make_pair(uint16_t port, size_t batch_size,
+                        clock::duration flush_interval,
+                        std::unique_ptr<local_link>& x,
+                        std::unique_ptr<local_link>& y) {
+    x = open(port, link_side::listen, batch_size, flush_interval);
+    y = x ? open(port, link_side::connect, batch_size, flush_interval)
+          : nullptr;
+    return x && y;
+  }
+
+private:
+  /// Message slots of `max_message_size` bytes with the headers that
+  /// `sendmmsg` and `recvmmsg` expect.
+  class batch {
+  public:
+    explicit batch(size_t size)
+        : buf_(size * max_message_size),
+          iov_(size),
+          hdrs_(size) {
+      for (size_t i = 0; i < size; ++i) {
+        iov_[i].iov_base = data(i);
+        iov_[i].iov_len = max_message_size;
+        hdrs_[i].msg_hdr.msg_iov = &iov_[i];
+        hdrs_[i].msg_hdr.msg_iovlen = 1;
+      }
+    }
+
+    batch(const batch&) = delete;
+    batch& operator=(const batch&) = delete;
+
+    char* data(size_t i) {
+      return buf_.data() + i * max_message_size;
+    }
+
+    void set_length(size_t i, size_t len) {
+      iov_[i].iov_len = len;
+    }
+
+    size_t received(size_t i) const {
+      return hdrs_[i].msg_len;
+    }
+
+    mmsghdr* headers(size_t first = 0) {
+      return hdrs_.data() + first;
+    }
+
+  private:
+    std::vector<char> buf_;
+    std::vector<iovec> iov_;
+    std::vector<mmsghdr> hdrs_;
+  };
+
+  bool send_batch() {
+    size_t sent = 0;
+    while (sent < tx_count_) {
+      count_syscall();
+      auto res = sendmmsg(fd_, tx_.headers(sent),
+                          static_cast<unsigned>(tx_count_ - sent), 0);
+      if (res <= 0)
+        break;
+      sent += static_cast<size_t>(res);
+    }
+    auto ok = sent == tx_count_;
+    tx_count_ = 0;
+    return ok;
+  }
+
+  size_t batch_size_;
+  clock::duration flush_interval_;
+  batch tx_;
+  batch rx_;
+  size_t tx_count_;
+  clock::time_point tx_first_;
+  size_t rx_count_;
+  size_t rx_next_;
+};
+#endif // __linux__
+
+/// Length-prefixed messages over a stream, like the TCP transport of the
+/// middleman. Disables Nagle's algorithm.
+class tcp_link : public socket_link {
+public:
+  using socket_link::socket_link;
+
+  bool send(const char* buf, size_t len) override {
+    auto prefix = static_cast<uint32_t>(len);
+    char frame[sizeof(prefix) + max_message_size];
+    memcpy(frame, &prefix, sizeof(prefix));
+    memcpy(frame + sizeof(prefix), buf, len);
+    return write_all(frame, sizeof(prefix) + len);
+  }
+
+  size_t receive(char* buf) override {
+    uint32_t len;
+    if (!read_all(reinterpret_cast<char*>(&len), sizeof(len))
+        || len > max_message_size || !read_all(buf, len))
+      return 0;
+    return len;
+  }
+
+  /// Returns the `listen` end of a link: waits for one connection on
+  /// `port`.
+  static std::unique_ptr<local_link> accept_one(uint16_t port) {
+    auto acceptor = listening(port);
+    if (acceptor < 0)
+      return nullptr;
+    auto fd = accept(acceptor, nullptr, nullptr);
+    close(acceptor);
+    return wrap(fd);
+  }
+
+  /// Returns the `connect` end of a link, or `nullptr` if nobody listens on
+  /// `port` yet.
+  static std::unique_ptr<local_link> connect_to(uint16_t port) {
+    auto addr = loopback(port);
+    auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, as_sockaddr(addr), sizeof(addr)) != 0) {
+      close(fd);
+      fd = -1;
+    }
+    return wrap(fd);
+  }
+
+  /// Returns a pair of links over a loopback connection on `port`.
+  static bool make_pair(uint16_t port, std::unique_ptr<local_link>& x,
+                        std::unique_ptr<local_link>& y) {
+    auto acceptor = listening(port);
+    if (acceptor < 0)
+      return false;
+    x = connect_to(port);
+    y = x ? wrap(accept(acceptor, nullptr, nullptr)) : nullptr;
+    close(acceptor);
+    return x && y;
+  }
+
+private:
+  static int listening(uint16_t port) {
+    auto addr = loopback(port);
+    auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (fd >= 0 && (bind(fd, as_sockaddr(addr), sizeof(addr)) != 0
+                    || listen(fd, 1) != 0)) {
+      close(fd);
+      return -1;
+    }
+    return fd;
+  }
+
+  static std::unique_ptr<local_link> wrap(int fd) {
+    if (fd < 0)
+      return nullptr;
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return std::unique_ptr<local_link>{new tcp_link(fd)};
+  }
+
+  bool write_all(const char* buf, size_t len) {
+    while (len > 0) {
+      count_syscall();
+      auto res = ::send(fd_, buf, len, 0);
+      if (res <= 0)
+        return false;
+      buf += res;
+      len -= static_cast<size_t>(res);
+    }
+    return true;
+  }
+
+  bool read_all(char* buf, size_t len) {
+    while (len > 0) {
+      count_syscall();
+      auto res = recv(fd_, buf, len, 0);
+      if (res <= 0)
+        return false;
+      buf += res;
+      len -= static_cast<size_t>(res);
+    }
+    return true;
+  }
+};
+
+/// Returns the name prefix of the shared memory segments for `port`.
+inline std::string shm_name(uint16_t port) {
+  return "/caf-bench-" + std::to_string(port);
+}
+
+/// Returns a connected pair of links of kind `x`. Sockets use `port` (UDP
+/// also `port + 1`), shared memory uses a segment name derived from it.
+/// Batching UDP links send and receive up to `batch_size` datagrams per
+/// syscall and are only available on Linux.
+inline bool make_link_pair(transport_kind x, uint16_t port,
+                           std::unique_ptr<local_link>& a,
+                           std::unique_ptr<local_link>& b,
+                           size_t batch_size = 32,
+                           std::chrono::microseconds flush_interval
+                             = std::chrono::microseconds(100)) {
+  switch (x) {
+    case transport_kind::shm:
+      return shm_link::make_pair(shm_name(port), 1 << 20, a, b);
+    case transport_kind::udp:
+      return udp_link::make_pair(port, a, b);
+    case transport_kind::udp_batch:
+#ifdef __linux__
+      return udp_batch_link::make_pair(port, batch_size, flush_interval, a,
+                                       b);
+#else
+      static_cast<void>(batch_size);
+      static_cast<void>(flush_interval);
+      return false;
+#endif
+    default:
+      return tcp_link::make_pair(port, a, b);
+  }
+}
+
+/// Opens the end `side` of a link of kind `x` to a peer process on the same
+/// host that opens the other end with the same `port`. The `connect` end
+/// retries until the `listen` end is there or `timeout` passed, so the
+/// `listen` end should start first. UDP needs no handshake: datagrams sent
+/// before the peer opened its end get lost.
+inline std::unique_ptr<local_link>
+open_link(transport_kind x, uint16_t port, link_side side,
+          size_t batch_size = 32,
+          std::chrono::microseconds flush_interval
+            = std::chrono::microseconds(100),
+          std::chrono::seconds timeout = std::chrono::seconds(10)) {
+  using clock = std::chrono::steady_clock;
+  auto until = clock::now() + timeout;
+  for (;;) {
+    std::unique_ptr<local_link> result;
+    switch (x) {
+      case transport_kind::shm:
+        result = side == link_side::listen
+                 ? shm_link::create(shm_name(port), 1 << 20)
+                 : shm_link::attach(shm_name(port));
+        break;
+      case transport_kind::udp:
+        result = udp_link::open(port, side);
+        break;
+      case transport_kind::udp_batch:
+#ifdef __linux__
+        result = udp_batch_link::open(port, side, batch_size, flush_interval);
+#else
+        static_cast<void>(batch_size);
+        static_cast<void>(flush_interval);
+#endif
+        break;
+      default:
+        result = side == link_side::listen ? tcp_link::accept_one(port)
+                                           : tcp_link::connect_to(port);
+    }
+    if (result || side == link_side::listen || clock::now() >= until)
+      return result;
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+}
+
+#endif // LOCAL_TRANSPORT_HPP
@@ -0,0 +1,136 @@
+#ifndef MESSAGE_STASH_HPP
+#define MESSAGE_STASH_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <caf/all.hpp>
+
+// -----------------------------------------------------------------------------
+//  MESSAGE STASH
+// -----------------------------------------------------------------------------
+
+/// Holds messages that arrive before an actor is ready for them, e.g., shares
+/// and pings from peers that started before the local node knows its
+/// successor. Skipping them would leave them in the mailbox, where they are
+/// scanned again on every dequeue. The stash takes each message out once and
+/// puts it back once in `drain`, keeping sender and request ID, so responses
+/// still reach the original requester. When the stash is full, `full_policy`
+/// decides what happens to further messages:
+/// - `drop`: discard the message, reliable senders retransmit it later
+/// - `nack`: answer requests with an error, so senders retry right away.
+///   Asynchronous messages have nobody to receive the error and are skipped
+///   instead, so they are not lost.
+/// - `backpressure`: skip the message, i.e., leave it in the mailbox. This
+///   does not slow down senders, CAF has no flow control for asynchronous
+///   messages. Every skipped message is scanned again on each dequeue until
+///   `drain`, so beyond the capacity the stash costs as much as not having
+///   one. Size the capacity for the expected early traffic.
+class message_stash {
+public:
+  enum policy {
+    drop,
+    nack,
+    backpressure
+  };
+
+  message_stash() : capacity_(1024), policy_(backpressure), high_water_mark_(0),
+                    dropped_(0), nacked_(0), skipped_(0) {
+    // nop
+  }
+
+  void configure(size_t capacity, policy full_policy) {
+    capacity_ = capacity;
+    policy_ = full_policy;
+  }
+
+  /// Parses "drop", "nack" or "backpressure" into `x`.
+  static bool parse(const std::string& str, policy& x) {
+    if (str == "drop")
+      x = drop;
+    else if (str == "nack")
+      x = nack;
+    else if (str == "backpressure")
+      x = backpressure;
+    else
+      return false;
+    return true;
+  }
+
+  /// Routes all messages without a matching handler into this stash. The
+  /// stash must outlive the default handler, e.g., by being part of the
+  /// actor state.
+  template <class Self>
+  void install(Self* self) {
+    self->set_default_handler([=](caf::scheduled_actor* ptr,
+                                  caf::message_view& x)
+                              -> caf::result<caf::message> {
+      if (elements_.size() >= capacity_) {
+        switch (policy_) {
+          case drop:
+            ++dropped_;
+            return caf::delegated<caf::message>{};
+          case nack:
+            if (ptr->current_message_id().is_request()) {
+              ++nacked_;
+              return caf::make_error(caf::sec::unexpected_message);
+            }
+            ++skipped_;
+            return caf::skip;
+          default:
+            ++skipped_;
+            return caf::skip;
+        }
+      }
+      elements_.push_back(element{ptr->current_sender(),
+                                  ptr->current_message_id(),
+                                  x.move_content_to_message()});
+      high_water_mark_ = std::max(high_water_mark_, elements_.size());
+      // The message is answered after draining.
+      return caf::delegated<caf::message>{};
+    });
+  }
+
+  /// Puts all stashed messages back into the mailbox and drops unexpected
+  /// messages from now on. The stashed messages keep their order among each
+  /// other but land at the tail of the mailbox, i.e., after messages that
+  /// arrived later and are still waiting. Callers must not rely on the order
+  /// between stashed and newer messages.
+  template <class Self>
+  void drain(Self* self) {
+    self->set_default_handler(caf::print_and_drop);
+    std::cout << "[q] draining " << elements_.size() << " early messages "
+              << "(high-water mark " << high_water_mark_ << ", dropped "
+              << dropped_ << ", nacked " << nacked_ << ", skipped "
+              << skipped_ << ")" << std::endl;
+    for (auto& x : elements_)
+      self->enqueue(caf::make_mailbox_element(std::move(x.sender), x.mid, {},
+                                              std::move(x.content)),
+                    self->context());
+    elements_.clear();
+  }
+
+  size_t high_water_mark() const {
+    return high_water_mark_;
+  }
+
+private:
+  struct element {
+    caf::strong_actor_ptr sender;
+    caf::message_id mid;
+    caf::message content;
+  };
+
+  std::vector<element> elements_;
+  size_t capacity_;
+  policy policy_;
+  size_t high_water_mark_;
+  size_t dropped_;
+  size_t nacked_;
+  size_t skipped_;
+};
+
+#endif // MESSAGE_STASH_HPP
@@ -0,0 +1,250 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+//  METRICS
+// -----------------------------------------------------------------------------
+
+/// Upper bounds (inclusive) for the buckets of a histogram plus a count and a
+/// sum, all of which can be updated concurrently without locking.
+class histogram {
+public:
+  explicit histogram(std::vector<double> bounds)
+      : bounds_(std::move(bounds)),
+        buckets_(new std::atomic<int64_t>[bounds_.size() + 1]),
+        count_(0),
+        sum_(0) {
+    for (size_t i = 0; i <= bounds_.size(); ++i)
+      buckets_[i] = 0;
+  }
+
+  void observe(double x) {
+    size_t i = 0;
+    while (i < bounds_.size() && x > bounds_[i])
+      ++i;
+    buckets_[i].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    // The sum is kept in microunits to stay integral.
+    sum_.fetch_add(static_cast<int64_t>(x * 1e6), std::memory_order_relaxed);
+  }
+
+  void render(std::ostream& out, const std::string& name,
+              const std::string& labels) const {
+    auto sep = labels.empty() ? "" : ",";
+    int64_t cumulative = 0;
+    for (size_t i = 0; i <= bounds_.size(); ++i) {
+      cumulative += buckets_[i].load(std::memory_order_relaxed);
+      out << name << "_bucket{" << labels << sep << "le=\"";
+      if (i < bounds_.size())
+        out << bounds_[i];
+      else
+        out << "+Inf";
+      out << "\"} " << cumulative << "\n";
+    }
+    auto braces = labels.empty() ? "" : "{" + labels + "}";
+    out << name << "_sum" << braces << " "
+        << sum_.load(std::memory_order_relaxed) / 1e6 << "\n"
+        << name << "_count" << braces << " "
+        << count_.load(std::memory_order_relaxed) << "\n";
+  }
+
+private:
+  std::vector<double> bounds_;
+  std::unique_ptr<std::atomic<int64_t>[]> buckets_;
+  std::atomic<int64_t> count_;
+  std::atomic<int64_t> sum_;
+};
+
+/// Process-wide registry of counters, gauges and histograms. Registering a
+/// metric takes a lock, updating it does not: callers keep the returned
+/// reference and update it with relaxed atomics. `render` produces the
+/// Prometheus text exposition format.
+class metrics {
+public:
+  using value = std::atomic<int64_t>;
+
+  static metrics& instance() {
+    static metrics registry;
+    return registry;
+  }
+
+  /// Adds `labels` (e.g., `node="x"`) to every metric.
+  void set_common_labels(std::string labels) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    common_labels_ = std::move(labels);
+  }
+
+  value& counter(const std::string& name, const std::string& help,
+                 const std::string& labels = "") {
+    return get(name, help, "counter", labels);
+  }
+
+  value& gauge(const std::string& name, const std::string& help,
+               const std::string& labels = "") {
+    return get(name, help, "gauge", labels);
+  }
+
+  histogram& hist(const std::string& name, const std::string& help,
+                  std::vector<double> bounds) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    auto& f = families_[name];
+    f.help = help;
+    f.type = "histogram";
+    if (!f.hist)
+      f.hist.reset(new histogram(std::move(bounds)));
+    return *f.hist;
+  }
+
+  std::string render() const {
+    std::lock_guard<std::mutex> guard{mtx_};
+    std::ostringstream out;
+    for (auto& kvp : families_) {
+      auto& name = kvp.first;
+      auto& f = kvp.second;
+      out << "# HELP " << name << " " << f.help << "\n"
+          << "# TYPE " << name << " " << f.type << "\n";
+      if (f.hist) {
+        f.hist->render(out, name, common_labels_);
+        continue;
+      }
+      for (auto& x : f.values) {
+        auto labels = join(common_labels_, x.first);
+        out << name;
+        if (!labels.empty())
+          out << "{" << labels << "}";
+        out << " " << x.second->load(std::memory_order_relaxed) << "\n";
+      }
+    }
+    return out.str();
+  }
+
+private:
+  struct family {
+    std::string help;
+    std::string type;
+    std::map<std::string, std::unique_ptr<value>> values;
+    std::unique_ptr<histogram> hist;
+  };
+
+  static std::string join(const std::string& x, const std::string& y) {
+    if (x.empty())
+      return y;
+    if (y.empty())
+      return x;
+    return x + "," + y;
+  }
+
+  value& get(const std::string& name, const std::string& help,
+             const char* type, const std::string& labels) {
+    std::lock_guard<std::mutex> guard{mtx_};
+    auto& f = families_[name];
+    f.help = help;
+    f.type = type;
+    auto& ptr = f.values[labels];
+    if (!ptr)
+      ptr.reset(new value(0));
+    return *ptr;
+  }
+
+  mutable std::mutex mtx_;
+  std::string common_labels_;
+  std::map<std::string, family> families_;
+};
+
+/// Serves `metrics::instance()` over HTTP on localhost from a background
+/// thread. Every request gets the full exposition regardless of the path.
+class metrics_server {
+public:
+  metrics_server() : fd_(-1), running_(false) {
+    // nop
+  }
+
+  ~metrics_server() {
+    stop();
+  }
+
+  bool start(uint16_t port) {
+    fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      return false;
+    int on = 1;
+    setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+        || listen(fd_, 8) != 0) {
+      close(fd_);
+      fd_ = -1;
+      return false;
+    }
+    running_ = true;
+    thread_ = std::thread{[this] { run(); }};
+    return true;
+  }
+
+  void stop() {
+    if (!running_)
+      return;
+    running_ = false;
+    thread_.join();
+    close(fd_);
+    fd_ = -1;
+  }
+
+private:
+  void run() {
+    while (running_) {
+      pollfd pfd{fd_, POLLIN, 0};
+      if (poll(&pfd, 1, 100) <= 0)
+        continue;
+      auto conn = accept(fd_, nullptr, nullptr);
+      if (conn < 0)
+        continue;
+      // The request itself does not matter, but reading it keeps clients
+      // from seeing a connection reset.
+      char buf[1024];
+      pollfd cfd{conn, POLLIN, 0};
+      if (poll(&cfd, 1, 100) > 0)
+        static_cast<void>(read(conn, buf, sizeof(buf)));
+      auto body = metrics::instance().render();
+      std::ostringstream out;
+      out << "HTTP/1.0 200 OK\r\n"
+          << "Content-Type: text/plain; version=0.0.4\r\n"
+          << "Content-Length: " << body.size() << "\r\n\r\n"
+          << body;
+      auto response = out.str();
+      size_t written = 0;
+      while (written < response.size()) {
+        auto n = write(conn, response.data() + written,
+                       response.size() - written);
+        if (n <= 0)
+          break;
+        written += static_cast<size_t>(n);
+      }
+      close(conn);
+    }
+  }
+
+  int fd_;
+  std::atomic<bool> running_;
+  std::thread thread_;
+};
+
+#endif // METRICS_HPP
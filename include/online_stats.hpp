@@ -0,0 +1,279 @@
+#ifndef ONLINE_STATS_HPP
+#define ONLINE_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+//  STREAMING STATISTICS
+// -----------------------------------------------------------------------------
+
+/// Mean and variance of a stream in constant space (Welford's algorithm).
+class running_stats {
+public:
+  running_stats() : count_(0), mean_(0.), m2_(0.) {
+    // nop
+  }
+
+  void add(double x) {
+    ++count_;
+    auto delta = x - mean_;
+    mean_ += delta / static_cast<double>(count_);
+    m2_ += delta * (x - mean_);
+  }
+
+  size_t count() const {
+    return count_;
+  }
+
+  double mean() const {
+    return mean_;
+  }
+
+  /// Returns the sample variance.
+  double variance() const {
+    return count_ > 1 ? m2_ / static_cast<double>(count_ - 1) : 0.;
+  }
+
+  double stddev() const {
+    return std::sqrt(variance());
+  }
+
+private:
+  size_t count_;
+  double mean_;
+  double m2_;
+};
+
+/// Estimates the `q`-quantile of a stream in constant space with the P^2
+/// algorithm of Jain and Chlamtac. The estimate is exact for up to five
+/// samples and moves five markers along a piecewise-parabolic curve after.
+class p2_quantile {
+public:
+  explicit p2_quantile(double q) : q_(q), count_(0) {
+    desired_ = {{1., 1. + 2. * q, 1. + 4. * q, 3. + 2. * q, 5.}};
+    step_ = {{0., q / 2., q, (1. + q) / 2., 1.}};
+    for (size_t i = 0; i < 5; ++i)
+      pos_[i] = static_cast<double>(i + 1);
+  }
+
+  void add(double x) {
+    if (count_ < 5) {
+      height_[count_++] = x;
+      std::sort(height_.begin(), height_.begin() + count_);
+      return;
+    }
+    ++count_;
+    size_t k;
+    if (x < height_[0]) {
+      height_[0] = x;
+      k = 0;
+    } else if (x >= height_[4]) {
+      height_[4] = x;
+      k = 3;
+    } else {
+      k = 0;
+      while (x >= height_[k + 1])
+        ++k;
+    }
+    for (auto i = k + 1; i < 5; ++i)
+      pos_[i] += 1.;
+    for (size_t i = 0; i < 5; ++i)
+      desired_[i] += step_[i];
+    for (size_t i = 1; i < 4; ++i) {
+      auto d = desired_[i] - pos_[i];
+      if ((d >= 1. && pos_[i + 1] - pos_[i] > 1.)
+          || (d <= -1. && pos_[i - 1] - pos_[i] < -1.)) {
+        auto s = d >= 0. ? 1. : -1.;
+        auto h = parabolic(i, s);
+        if (height_[i - 1] < h && h < height_[i + 1])
+          height_[i] = h;
+        else
+          height_[i] = linear(i, s);
+        pos_[i] += s;
+      }
+    }
+  }
+
+  size_t count() const {
+    return count_;
+  }
+
+  double value() const {
+    if (count_ == 0)
+      return 0.;
+    if (count_ <= 5) {
+      auto i = static_cast<size_t>(q_ * static_cast<double>(count_ - 1) + .5);
+      return height_[i];
+    }
+    return height_[2];
+  }
+
+private:
+  double parabolic(size_t i, double s) const {
+    auto n0 = pos_[i - 1];
+    auto n1 = pos_[i];
+    auto n2 = pos_[i + 1];
+    return height_[i]
+           + s / (n2 - n0)
+               * ((n1 - n0 + s) * (height_[i + 1] - height_[i]) / (n2 - n1)
+                  + (n2 - n1 - s) * (height_[i] - height_[i - 1]) / (n1 - n0));
+  }
+
+  double linear(size_t i, double s) const {
+    auto j = s > 0. ? i + 1 : i - 1;
+    return height_[i] + s * (height_[j] - height_[i]) / (pos_[j] - pos_[i]);
+  }
+
+  double q_;
+  size_t count_;
+  std::array<double, 5> height_;
+  std::array<double, 5> pos_;
+  std::array<double, 5> desired_;
+  std::array<double, 5> step_;
+};
+
+/// Returns the two-sided 95% quantile of Student's t-distribution.
+inline double t95(size_t degrees_of_freedom) {
+  static constexpr double table[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+  };
+  if (degrees_of_freedom == 0)
+    return 0.;
+  if (degrees_of_freedom <= 30)
+    return table[degrees_of_freedom - 1];
+  return 1.960;
+}
+
+/// Summarizes a stream of measurements without its warm-up period.
+///
+/// Samples are grouped into batches. The warm-up ends with the first batch
+/// whose mean lies within `tolerance` of the mean of the batch before; the
+/// samples of all batches before that pair are discarded. Afterwards, the
+/// batch means provide the confidence interval of the mean (method of batch
+/// means), which stays valid for correlated samples such as consecutive
+/// RTTs, as long as batches are long compared to the correlation.
+class stream_summary {
+public:
+  stream_summary()
+      : batch_size_(32),
+        tolerance_(.1),
+        warm_(false),
+        discarded_(0),
+        p50_(.5),
+        p90_(.9),
+        p99_(.99) {
+    // nop
+  }
+
+  void configure(size_t batch_size, double tolerance) {
+    batch_size_ = std::max(size_t{2}, batch_size);
+    tolerance_ = tolerance;
+  }
+
+  void add(double x) {
+    batch_.push_back(x);
+    if (batch_.size() < batch_size_)
+      return;
+    if (warm_) {
+      accept(batch_);
+    } else if (!previous_.empty()
+               && std::abs(mean_of(batch_) - mean_of(previous_))
+                    <= tolerance_ * std::abs(mean_of(previous_))) {
+      warm_ = true;
+      accept(previous_);
+      accept(batch_);
+      previous_.clear();
+    } else {
+      discarded_ += previous_.size();
+      previous_.swap(batch_);
+    }
+    batch_.clear();
+  }
+
+  /// Returns whether the warm-up period is over.
+  bool warm() const {
+    return warm_;
+  }
+
+  /// Returns the number of leading samples that belong to the warm-up.
+  size_t discarded() const {
+    return discarded_;
+  }
+
+  /// Returns statistics over all samples after the warm-up.
+  const running_stats& samples() const {
+    return samples_;
+  }
+
+  /// Returns statistics over the means of all batches after the warm-up.
+  const running_stats& batches() const {
+    return batches_;
+  }
+
+  double p50() const {
+    return p50_.value();
+  }
+
+  double p90() const {
+    return p90_.value();
+  }
+
+  double p99() const {
+    return p99_.value();
+  }
+
+  /// Returns the half width of the 95% confidence interval of the mean or 0
+  /// if there are fewer than two batches.
+  double ci95() const {
+    auto n = batches_.count();
+    if (n < 2)
+      return 0.;
+    return t95(n - 1) * batches_.stddev() / std::sqrt(static_cast<double>(n));
+  }
+
+  /// Returns whether at least `min_batches` batches passed the warm-up and the
+  /// 95% confidence interval is narrower than `target` times the mean.
+  bool conclusive(double target, size_t min_batches = 5) const {
+    return warm_ && batches_.count() >= std::max(size_t{2}, min_batches)
+           && ci95() <= target * std::abs(samples_.mean());
+  }
+
+private:
+  static double mean_of(const std::vector<double>& xs) {
+    double sum = 0.;
+    for (auto x : xs)
+      sum += x;
+    return xs.empty() ? 0. : sum / static_cast<double>(xs.size());
+  }
+
+  void accept(const std::vector<double>& xs) {
+    for (auto x : xs) {
+      samples_.add(x);
+      p50_.add(x);
+      p90_.add(x);
+      p99_.add(x);
+    }
+    batches_.add(mean_of(xs));
+  }
+
+  size_t batch_size_;
+  double tolerance_;
+  bool warm_;
+  size_t discarded_;
+  std::vector<double> batch_;
+  std::vector<double> previous_;
+  running_stats samples_;
+  running_stats batches_;
+  p2_quantile p50_;
+  p2_quantile p90_;
+  p2_quantile p99_;
+};
+
+#endif // ONLINE_STATS_HPP
@@ -0,0 +1,261 @@
+#ifndef PACING_HPP
+#define PACING_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <unordered_map>
+
+// -----------------------------------------------------------------------------
+//  CONGESTION CONTROL AND PACING
+// -----------------------------------------------------------------------------
+
+/// Additive-increase/multiplicative-decrease window of one destination. The
+/// window limits how many messages may wait for an ack at the same time. It
+/// grows by one message per window of acks and halves on every timeout.
+class aimd_window {
+public:
+  aimd_window(double initial = 4., double max = 64.)
+      : cwnd_(initial),
+        max_(max),
+        in_flight_(0) {
+    // nop
+  }
+
+  bool open() const {
+    return in_flight_ < static_cast<uint32_t>(cwnd_);
+  }
+
+  uint32_t in_flight() const {
+    return in_flight_;
+  }
+
+  double size() const {
+    return cwnd_;
+  }
+
+  void sent() {
+    ++in_flight_;
+  }
+
+  void acked() {
+    release();
+    cwnd_ = std::min(max_, cwnd_ + 1. / cwnd_);
+  }
+
+  /// Shrinks the window. The message stays in flight if it gets
+  /// retransmitted.
+  void timed_out() {
+    cwnd_ = std::max(1., cwnd_ / 2.);
+  }
+
+  /// Removes a message from the window without growing it, e.g., after
+  /// giving up on it.
+  void release() {
+    if (in_flight_ > 0)
+      --in_flight_;
+  }
+
+private:
+  double cwnd_;
+  double max_;
+  uint32_t in_flight_;
+};
+
+/// Token bucket that limits the rate of all sends of a node together, so
+/// that a fan-out to many destinations does not leave in a single burst.
+class pacer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  pacer() : rate_(0.), burst_(1.), tokens_(1.), last_(clock::now()) {
+    // nop
+  }
+
+  /// Allows `rate` messages per second on average and up to `burst` at once.
+  /// A rate of 0 disables pacing.
+  void configure(double rate, double burst) {
+    rate_ = rate;
+    burst_ = std::max(1., burst);
+    tokens_ = burst_;
+    last_ = clock::now();
+  }
+
+  /// Takes a token and returns zero if a message may go out now, otherwise
+  /// returns the time until the next token becomes available.
+  clock::duration acquire() {
+    if (rate_ <= 0.)
+      return clock::duration::zero();
+    auto now = clock::now();
+    std::chrono::duration<double> elapsed = now - last_;
+    last_ = now;
+    tokens_ = std::min(burst_, tokens_ + elapsed.count() * rate_);
+    if (tokens_ >= 1.) {
+      tokens_ -= 1.;
+      return clock::duration::zero();
+    }
+    std::chrono::duration<double> wait{(1. - tokens_) / rate_};
+    return std::max(clock::duration{1},
+                    std::chrono::duration_cast<clock::duration>(wait));
+  }
+
+private:
+  double rate_;
+  double burst_;
+  double tokens_;
+  clock::time_point last_;
+};
+
+/// Derives a retransmission timeout from measured round trips as in RFC
+/// 6298: a smoothed RTT plus four times its mean deviation, clamped to
+/// `[min, max]`. Until the first sample, the timeout is `initial`.
+class rtt_estimator {
+public:
+  using duration = std::chrono::microseconds;
+
+  rtt_estimator(duration initial = std::chrono::milliseconds(200),
+                duration min = std::chrono::milliseconds(10),
+                duration max = std::chrono::seconds(5))
+      : initial_(initial),
+        min_(min),
+        max_(max),
+        srtt_(0.),
+        rttvar_(0.),
+        samples_(0) {
+    // nop
+  }
+
+  /// Adds a round trip of `rtt`.
+  void add(duration rtt) {
+    auto x = static_cast<double>(rtt.count());
+    if (samples_++ == 0) {
+      srtt_ = x;
+      rttvar_ = x / 2.;
+      return;
+    }
+    rttvar_ = .75 * rttvar_ + .25 * std::abs(srtt_ - x);
+    srtt_ = .875 * srtt_ + .125 * x;
+  }
+
+  size_t samples() const {
+    return samples_;
+  }
+
+  duration timeout() const {
+    if (samples_ == 0)
+      return initial_;
+    duration rto{static_cast<duration::rep>(srtt_ + 4. * rttvar_)};
+    return std::min(max_, std::max(min_, rto));
+  }
+
+private:
+  duration initial_;
+  duration min_;
+  duration max_;
+  double srtt_;
+  double rttvar_;
+  size_t samples_;
+};
+
+/// Holds back sends per destination until its window and the pacer allow
+/// them. Destinations take turns in round-robin order, also across calls to
+/// `pump`, so a long queue for one node does not delay the first message to
+/// all others even if the pacer releases only one message per call. The
+/// owner calls `pump` after every change (new message, ack, timeout) and
+/// schedules another `pump` after the returned delay if it is not zero.
+template <class Key>
+class send_queue {
+public:
+  using task = std::function<void()>;
+
+  send_queue() : initial_window_(0), max_window_(0), pacing_(false) {
+    // nop
+  }
+
+  /// A window of 0 disables congestion control.
+  void configure(uint32_t initial_window, uint32_t max_window, double rate,
+                 double burst) {
+    initial_window_ = initial_window;
+    max_window_ = std::max(initial_window, max_window);
+    pacing_ = rate > 0.;
+    pacer_.configure(rate, burst);
+  }
+
+  /// Returns whether either a window or pacing is active.
+  bool enabled() const {
+    return initial_window_ > 0 || pacing_;
+  }
+
+  void push(const Key& dest, task f) {
+    auto& q = queues_[dest];
+    if (q.empty())
+      turns_.push_back(dest);
+    q.push_back(std::move(f));
+  }
+
+  aimd_window& window(const Key& dest) {
+    auto i = windows_.find(dest);
+    if (i == windows_.end())
+      i = windows_.emplace(dest, aimd_window{static_cast<double>(
+                                               initial_window_),
+                                             static_cast<double>(max_window_)})
+            .first;
+    return i->second;
+  }
+
+  /// Runs queued sends while windows and pacer allow. Each send counts
+  /// towards the window of its destination. Sends must not call `push`.
+  pacer::clock::duration pump() {
+    // Stop once every destination in turn had a closed window.
+    size_t blocked = 0;
+    while (blocked < turns_.size()) {
+      auto dest = turns_.front();
+      if (initial_window_ > 0 && !window(dest).open()) {
+        turns_.pop_front();
+        turns_.push_back(dest);
+        ++blocked;
+        continue;
+      }
+      // On a wait, `dest` stays at the front and goes first next time.
+      auto wait = pacer_.acquire();
+      if (wait != pacer::clock::duration::zero())
+        return wait;
+      turns_.pop_front();
+      auto i = queues_.find(dest);
+      auto f = std::move(i->second.front());
+      i->second.pop_front();
+      if (i->second.empty())
+        queues_.erase(i);
+      else
+        turns_.push_back(dest);
+      if (initial_window_ > 0)
+        window(dest).sent();
+      f();
+      blocked = 0;
+    }
+    return pacer::clock::duration::zero();
+  }
+
+  size_t queued() const {
+    size_t result = 0;
+    for (auto& kvp : queues_)
+      result += kvp.second.size();
+    return result;
+  }
+
+private:
+  uint32_t initial_window_;
+  uint32_t max_window_;
+  bool pacing_;
+  pacer pacer_;
+  std::unordered_map<Key, std::deque<task>> queues_;
+  /// Destinations with queued sends, the next one to send first.
+  std::deque<Key> turns_;
+  std::unordered_map<Key, aimd_window> windows_;
+};
+
+#endif // PACING_HPP
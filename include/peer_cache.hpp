@@ -0,0 +1,57 @@
+#ifndef PEER_CACHE_HPP
+#define PEER_CACHE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+//  PEER CONTACT CACHE
+// -----------------------------------------------------------------------------
+
+/// How to reach the published actor of a node. Node and actor ID identify the
+/// incarnation that was known when the cache was written. A node that
+/// restarted since then is still reachable at its host and port, but under a
+/// new ID.
+struct peer_contact {
+  std::string name;
+  std::string host;
+  uint16_t port;
+  std::string node;
+  uint64_t actor_id;
+};
+
+/// Reads contacts written by `save_peer_cache`, one per line. Returns `false`
+/// if the file does not exist. Skips malformed lines.
+inline bool load_peer_cache(const std::string& path,
+                            std::vector<peer_contact>& xs) {
+  std::ifstream in{path};
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::istringstream fields{line};
+    peer_contact x;
+    if (fields >> x.name >> x.host >> x.port >> x.node >> x.actor_id)
+      xs.emplace_back(std::move(x));
+  }
+  return true;
+}
+
+inline bool save_peer_cache(const std::string& path,
+                            const std::vector<peer_contact>& xs) {
+  std::ofstream out{path};
+  if (!out)
+    return false;
+  out << "# name host port node actor-id" << std::endl;
+  for (auto& x : xs)
+    out << x.name << ' ' << x.host << ' ' << x.port << ' ' << x.node << ' '
+        << x.actor_id << std::endl;
+  return static_cast<bool>(out);
+}
+
+#endif // PEER_CACHE_HPP
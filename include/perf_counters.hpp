@@ -0,0 +1,192 @@
+#ifndef PERF_COUNTERS_HPP
+#define PERF_COUNTERS_HPP
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "process_threads.hpp"
+
+// -----------------------------------------------------------------------------
+//  HARDWARE PERFORMANCE COUNTERS
+// -----------------------------------------------------------------------------
+
+/// Records hardware and kernel counters for named phases of a benchmark via
+/// `perf_event_open`. Counters are opened for every thread of the process at
+/// the beginning of a phase, so scheduler and middleman threads are included.
+/// Counters are inherited, so threads spawned during a phase count as well
+/// once they have exited before the phase stops. An event the kernel refuses
+/// for any thread (e.g., because of `perf_event_paranoid`) is reported as
+/// unavailable instead of failing the run, since its sum would be partial.
+/// On other platforms, all events are unavailable.
+class perf_counters {
+public:
+  enum event {
+    cycles,
+    instructions,
+    cache_misses,
+    context_switches,
+    syscalls,
+    num_events
+  };
+
+  struct phase {
+    std::string name;
+    std::array<uint64_t, num_events> values;
+    std::array<bool, num_events> available;
+  };
+
+  ~perf_counters() {
+    close_all();
+  }
+
+  void start(std::string name) {
+    close_all();
+    current_.name = std::move(name);
+    current_.values.fill(0);
+    current_.available.fill(false);
+#ifdef __linux__
+    std::array<bool, num_events> refused;
+    refused.fill(false);
+    for (auto tid : process_threads())
+      for (int e = 0; e < num_events; ++e) {
+        auto fd = open_event(static_cast<event>(e), tid);
+        if (fd >= 0) {
+          fds_.emplace_back(e, fd);
+          current_.available[e] = true;
+        } else {
+          refused[e] = true;
+        }
+      }
+    for (int e = 0; e < num_events; ++e)
+      if (refused[e])
+        current_.available[e] = false;
+    for (auto& x : fds_)
+      ioctl(x.second, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+  }
+
+  void stop() {
+#ifdef __linux__
+    for (auto& x : fds_) {
+      ioctl(x.second, PERF_EVENT_IOC_DISABLE, 0);
+      uint64_t value = 0;
+      if (read(x.second, &value, sizeof(value)) == sizeof(value))
+        current_.values[x.first] += value;
+    }
+#endif
+    close_all();
+    phases_.push_back(current_);
+  }
+
+  const std::vector<phase>& phases() const {
+    return phases_;
+  }
+
+  static const char* event_name(int e) {
+    static const char* names[] = {"cycles", "instructions", "cache_misses",
+                                  "context_switches", "syscalls"};
+    return names[e];
+  }
+
+  /// Writes all recorded phases as a JSON object. Unavailable events are
+  /// written as `null`.
+  void write_json(std::ostream& out, const std::string& node) const {
+    out << "{" << std::endl
+        << "  \"name\": \"" << node << "\"," << std::endl
+        << "  \"phases\": {";
+    for (size_t i = 0; i < phases_.size(); ++i) {
+      auto& p = phases_[i];
+      out << (i == 0 ? "" : ",") << std::endl
+          << "    \"" << p.name << "\": {";
+      for (int e = 0; e < num_events; ++e) {
+        out << (e == 0 ? "" : ", ") << "\"" << event_name(e) << "\": ";
+        if (p.available[e])
+          out << p.values[e];
+        else
+          out << "null";
+      }
+      out << "}";
+    }
+    out << std::endl << "  }" << std::endl << "}" << std::endl;
+  }
+
+private:
+  void close_all() {
+#ifdef __linux__
+    for (auto& x : fds_)
+      close(x.second);
+#endif
+    fds_.clear();
+  }
+
+#ifdef __linux__
+  /// Returns the ID of the `raw_syscalls:sys_enter` tracepoint or -1.
+  static long long syscall_tracepoint() {
+    for (auto path : {"/sys/kernel/tracing/events/raw_syscalls/sys_enter/id",
+                      "/sys/kernel/debug/tracing/events/raw_syscalls/"
+                      "sys_enter/id"}) {
+      std::ifstream in{path};
+      long long id;
+      if (in >> id)
+        return id;
+    }
+    return -1;
+  }
+
+  static int open_event(event e, pid_t tid) {
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_hv = 1;
+    switch (e) {
+      case cycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case instructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case cache_misses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_MISSES;
+        break;
+      case context_switches:
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+        break;
+      case syscalls: {
+        static auto id = syscall_tracepoint();
+        if (id < 0)
+          return -1;
+        attr.type = PERF_TYPE_TRACEPOINT;
+        attr.config = static_cast<uint64_t>(id);
+        break;
+      }
+      default:
+        return -1;
+    }
+    return static_cast<int>(syscall(__NR_perf_event_open, &attr, tid, -1, -1,
+                                    0));
+  }
+#endif
+
+  phase current_;
+  std::vector<phase> phases_;
+  std::vector<std::pair<int, int>> fds_;
+};
+
+#endif // PERF_COUNTERS_HPP
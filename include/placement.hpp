@@ -0,0 +1,162 @@
+#ifndef PLACEMENT_HPP
+#define PLACEMENT_HPP
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <caf/actor_system.hpp>
+#include <caf/actor_system_config.hpp>
+#include <caf/io/middleman.hpp>
+
+#include "process_threads.hpp"
+
+// -----------------------------------------------------------------------------
+//  THREAD PLACEMENT
+// -----------------------------------------------------------------------------
+
+/// Pins the threads of an actor system to CPU sets and optionally binds their
+/// memory to a NUMA node. All threads that exist when `apply` runs (scheduler
+/// workers, timer, printer and main thread) go to `cpus`. The middleman thread
+/// then moves itself to `io_cpus`. Setting only `numa_node` uses the CPUs of
+/// that node for both sets. Threads allocate from their local node by default,
+/// so pinning workers to the CPUs of a node also keeps their memory there. The
+/// main and middleman threads additionally bind their memory explicitly.
+struct placement {
+  std::string cpus;
+  std::string io_cpus;
+  int numa_node = -1;
+
+  /// Adds the options `cpus`, `io-cpus` and `numa-node` to the global
+  /// section of a config.
+  void add_options(caf::actor_system_config::option_vector& xs) {
+    caf::opt_group{xs, "global"}
+      .add(cpus,       "cpus",         "pin scheduler threads to these CPUs "
+                                       "(e.g. 0-3,8)")
+      .add(io_cpus,    "io-cpus",      "pin the middleman thread to these CPUs")
+      .add(numa_node,  "numa-node",    "bind memory (and CPUs unless given) "
+                                       "to this NUMA node");
+  }
+
+  /// Applies the placement stored in `config.pin` to `sys` and returns it
+  /// with derived CPU sets filled in. Reports failures on stderr.
+  template <class Config>
+  static placement from(caf::actor_system& sys, const Config& config) {
+    auto result = config.pin;
+    if (!result.empty() && !result.apply(sys))
+      std::cerr << "Could not apply thread placement (" << result.to_string()
+                << ")" << std::endl;
+    return result;
+  }
+
+  bool empty() const {
+    return cpus.empty() && io_cpus.empty() && numa_node < 0;
+  }
+
+  /// Returns a summary suitable for benchmark output.
+  std::string to_string() const {
+    std::ostringstream out;
+    out << "cpus=" << (cpus.empty() ? "any" : cpus)
+        << " io-cpus=" << (io_cpus.empty() ? "any" : io_cpus)
+        << " numa-node=" << numa_node;
+    return out.str();
+  }
+
+  /// Applies the placement to all threads of `sys` and fills in CPU sets that
+  /// were derived from `numa_node`. Returns `false` if any step failed.
+  bool apply(caf::actor_system& sys) {
+#ifdef __linux__
+    if (numa_node >= 0) {
+      auto node_cpus = cpus_of_node(numa_node);
+      if (cpus.empty())
+        cpus = node_cpus;
+      if (io_cpus.empty())
+        io_cpus = node_cpus;
+    }
+    auto ok = true;
+    cpu_set_t set;
+    if (!cpus.empty()) {
+      if (!parse_cpus(cpus, set))
+        return false;
+      for (auto tid : process_threads())
+        ok = sched_setaffinity(tid, sizeof(set), &set) == 0 && ok;
+    }
+    if (numa_node >= 0)
+      ok = bind_memory(numa_node) && ok;
+    if (!io_cpus.empty() || numa_node >= 0) {
+      cpu_set_t io_set;
+      CPU_ZERO(&io_set);
+      if (!io_cpus.empty() && !parse_cpus(io_cpus, io_set))
+        return false;
+      auto pin = !io_cpus.empty();
+      auto node = numa_node;
+      sys.middleman().backend().dispatch([=] {
+        if (pin)
+          sched_setaffinity(0, sizeof(io_set), &io_set);
+        if (node >= 0)
+          bind_memory(node);
+      });
+    }
+    return ok;
+#else
+    static_cast<void>(sys);
+    return empty();
+#endif
+  }
+
+#ifdef __linux__
+  /// Parses a CPU list in the format of `taskset -c`, e.g., "0-3,8".
+  static bool parse_cpus(const std::string& str, cpu_set_t& set) {
+    CPU_ZERO(&set);
+    std::istringstream in{str};
+    std::string range;
+    auto any = false;
+    while (std::getline(in, range, ',')) {
+      if (range.empty())
+        continue;
+      char* end = nullptr;
+      auto first = std::strtol(range.c_str(), &end, 10);
+      auto last = first;
+      if (*end == '-')
+        last = std::strtol(end + 1, &end, 10);
+      if (*end != '\0' && *end != '\n')
+        return false;
+      if (first < 0 || last < first || last >= CPU_SETSIZE)
+        return false;
+      for (auto cpu = first; cpu <= last; ++cpu)
+        CPU_SET(static_cast<int>(cpu), &set);
+      any = true;
+    }
+    return any;
+  }
+
+  static std::string cpus_of_node(int node) {
+    std::ifstream in{"/sys/devices/system/node/node" + std::to_string(node)
+                     + "/cpulist"};
+    std::string result;
+    std::getline(in, result);
+    return result;
+  }
+
+  /// Restricts future allocations of the calling thread to `node`.
+  static bool bind_memory(int node) {
+    if (node < 0 || node >= static_cast<int>(8 * sizeof(unsigned long)))
+      return false;
+    unsigned long mask = 1ul << node;
+    return syscall(SYS_set_mempolicy, MPOL_BIND, &mask,
+                   8 * sizeof(unsigned long)) == 0;
+  }
+#endif
+};
+
+#endif // PLACEMENT_HPP
@@ -0,0 +1,31 @@
+#ifndef PROCESS_THREADS_HPP
+#define PROCESS_THREADS_HPP
+
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/types.h>
+#endif
+
+// -----------------------------------------------------------------------------
+//  THREADS OF THIS PROCESS
+// -----------------------------------------------------------------------------
+
+#ifdef __linux__
+/// Returns the IDs of all threads of this process.
+inline std::vector<pid_t> process_threads() {
+  std::vector<pid_t> result;
+  auto dir = opendir("/proc/self/task");
+  if (dir == nullptr)
+    return result;
+  while (auto entry = readdir(dir))
+    if (entry->d_name[0] != '.')
+      result.push_back(static_cast<pid_t>(std::stol(entry->d_name)));
+  closedir(dir);
+  return result;
+}
+#endif
+
+#endif // PROCESS_THREADS_HPP
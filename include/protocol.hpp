@@ -0,0 +1,204 @@
+#ifndef PROTOCOL_HPP
+#define PROTOCOL_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include <caf/actor.hpp>
+#include <caf/actor_system_config.hpp>
+#include <caf/atom.hpp>
+#include <caf/meta/type_name.hpp>
+#include <caf/replies_to.hpp>
+#include <caf/typed_actor.hpp>
+
+// -----------------------------------------------------------------------------
+//  PROTOCOL MESSAGES
+// -----------------------------------------------------------------------------
+
+// Messages of the reliable ring protocols of `ping`, `pong` and `simple`.
+// Each one carries the sequence number assigned by `send_reliably`, which the
+// receiver acknowledges with an `ack_msg`. In `ping`, these structs are the
+// wire format of the `ring_message` values of `ring_protocol.hpp`. All fields
+// have a fixed width except the handle list exchanged during discovery and the
+// parity bytes of `parity_msg`. Names are only used locally for debugging and
+// never go over the wire.
+
+struct ack_msg {
+  uint32_t seq;
+};
+
+struct ping_msg {
+  uint32_t seq;
+};
+
+/// Answers a `ping_msg`. Tells whether the sender was started as leader.
+struct pong_msg {
+  bool leader;
+  uint32_t seq;
+};
+
+/// Reports that `completed` nodes of a subtree received all their pongs.
+struct done_msg {
+  uint32_t completed;
+  uint32_t seq;
+};
+
+struct shutdown_msg {
+  uint32_t seq;
+};
+
+/// Summarizes what the sender knows. Each node keeps the actors it knows in
+/// the order it learned them, so the number of known actors works as a
+/// version: a receiver that saw a smaller version from the same sender
+/// misses the actors learned since.
+struct digest_msg {
+  uint32_t version;
+  uint32_t seq;
+};
+
+/// Asks for all actors the receiver learned after the first `from`.
+struct pull_msg {
+  uint32_t from;
+  uint32_t seq;
+};
+
+/// Delivers actors in response to a `pull_msg`. In `pong`, passes a single
+/// actor along the ring instead.
+struct share_msg {
+  std::vector<caf::actor> handles;
+  uint32_t seq;
+};
+
+/// Token that walks the ring of `pong`.
+struct tag_msg {
+  uint32_t seq;
+};
+
+/// XOR parity of the reliable messages `[first, first + count)` to one node
+/// in `pong`. Not acknowledged and carries no sequence number.
+struct parity_msg {
+  uint32_t first;
+  uint32_t count;
+  std::vector<char> bytes;
+};
+
+/// Walks the ring of `simple` to tell each node its leader and the node that
+/// coordinates it. `position` counts the hops from the leader.
+struct announce_msg {
+  caf::actor leader;
+  caf::actor coordinator;
+  uint32_t position;
+  uint32_t seq;
+};
+
+/// Registers the sender with its coordinator in `simple`.
+struct peer_msg {
+  uint32_t seq;
+};
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, ack_msg& x) {
+  return f(caf::meta::type_name("ack_msg"), x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, ping_msg& x) {
+  return f(caf::meta::type_name("ping_msg"), x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, pong_msg& x) {
+  return f(caf::meta::type_name("pong_msg"), x.leader, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, done_msg& x) {
+  return f(caf::meta::type_name("done_msg"), x.completed, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, shutdown_msg& x) {
+  return f(caf::meta::type_name("shutdown_msg"), x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, digest_msg& x) {
+  return f(caf::meta::type_name("digest_msg"), x.version, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, pull_msg& x) {
+  return f(caf::meta::type_name("pull_msg"), x.from, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, share_msg& x) {
+  return f(caf::meta::type_name("share_msg"), x.handles, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, tag_msg& x) {
+  return f(caf::meta::type_name("tag_msg"), x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, parity_msg& x) {
+  return f(caf::meta::type_name("parity_msg"), x.first, x.count, x.bytes);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, announce_msg& x) {
+  return f(caf::meta::type_name("announce_msg"), x.leader, x.coordinator,
+           x.position, x.seq);
+}
+
+template <class Inspector>
+typename Inspector::result_type inspect(Inspector& f, peer_msg& x) {
+  return f(caf::meta::type_name("peer_msg"), x.seq);
+}
+
+/// Triggers sending the digest of all known actors to the next node.
+using digest_atom = caf::atom_constant<caf::atom("digest")>;
+
+/// Fires when a reliable message did not get its ack in time.
+using timeout_atom = caf::atom_constant<caf::atom("timeout")>;
+
+/// Triggers a periodic sample of metrics that are too costly to update on
+/// every message.
+using sample_atom = caf::atom_constant<caf::atom("sample")>;
+
+/// Interface of the protocol actor in `ping`. The handle of the next node and
+/// the receiver of a timed out message arrive as dynamically typed `actor`,
+/// since an interface cannot refer to itself. Acks are separate messages
+/// rather than responses, as in `pong`.
+using ping_actor = caf::typed_actor<
+  caf::reacts_to<caf::actor>,
+  caf::reacts_to<digest_atom>,
+  caf::reacts_to<sample_atom>,
+  caf::reacts_to<timeout_atom, caf::actor, uint32_t, int>,
+  caf::reacts_to<ack_msg>,
+  caf::reacts_to<digest_msg>,
+  caf::reacts_to<pull_msg>,
+  caf::reacts_to<share_msg>,
+  caf::reacts_to<ping_msg>,
+  caf::reacts_to<pong_msg>,
+  caf::reacts_to<done_msg>,
+  caf::reacts_to<shutdown_msg>>;
+
+/// Announces all protocol messages to the type system of `cfg`.
+inline void add_protocol_types(caf::actor_system_config& cfg) {
+  cfg.add_message_type<ack_msg>("ack_msg");
+  cfg.add_message_type<ping_msg>("ping_msg");
+  cfg.add_message_type<pong_msg>("pong_msg");
+  cfg.add_message_type<done_msg>("done_msg");
+  cfg.add_message_type<shutdown_msg>("shutdown_msg");
+  cfg.add_message_type<digest_msg>("digest_msg");
+  cfg.add_message_type<pull_msg>("pull_msg");
+  cfg.add_message_type<share_msg>("share_msg");
+  cfg.add_message_type<tag_msg>("tag_msg");
+  cfg.add_message_type<parity_msg>("parity_msg");
+  cfg.add_message_type<announce_msg>("announce_msg");
+  cfg.add_message_type<peer_msg>("peer_msg");
+}
+
+#endif // PROTOCOL_HPP
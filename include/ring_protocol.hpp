@@ -0,0 +1,467 @@
+#ifndef RING_PROTOCOL_HPP
+#define RING_PROTOCOL_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <set>
+#include <utility>
+#include <vector>
+
+#include "spanning_tree.hpp"
+
+// -----------------------------------------------------------------------------
+//  RING PROTOCOL
+// -----------------------------------------------------------------------------
+
+// The protocol of `ping` without a transport. Versioned digests, pulls and
+// shares discover all nodes along the ring, every node pings every node it
+// learns, done reports travel up a spanning tree and the shutdown travels
+// back down. Every message goes out with a sequence number and gets
+// retransmitted until the receiver sends an explicit ack. The inputs of a
+// node are events: it got connected to the next node, a message or an ack
+// arrived, a timer fired. Its outputs are calls to a driver that puts
+// messages on the wire and starts timers. `ping` drives it with CAF actors,
+// `simulate` with a virtual clock and a network model, so both run the same
+// code.
+
+enum class ring_kind : uint8_t {
+  digest,
+  pull,
+  share,
+  ping,
+  pong,
+  done,
+  shutdown,
+  num_kinds
+};
+
+inline const char* to_string(ring_kind x) {
+  static constexpr const char* names[] = {
+    "digest", "pull", "share", "ping", "pong", "done", "shutdown"
+  };
+  return names[static_cast<size_t>(x)];
+}
+
+/// A protocol message addressed with handles of type `Peer`. Fields that a
+/// kind does not use stay zero or empty.
+template <class Peer>
+struct ring_message {
+  ring_kind kind;
+  uint32_t seq;
+  /// Version of a digest, first index of a pull or share, or the completed
+  /// nodes of a done report.
+  uint32_t value;
+  /// Tells whether the sender of a pong was started as leader.
+  bool leader;
+  /// Nodes delivered by a share.
+  std::vector<Peer> peers;
+};
+
+struct ring_config {
+  /// Number of nodes besides this one.
+  uint32_t others = 7;
+  /// Fan-out of the termination tree (0 = all nodes report to the root).
+  uint32_t fanout = 2;
+  /// Time to collect new nodes before sending a digest.
+  std::chrono::milliseconds digest_delay{5};
+  int max_retransmits = 3;
+  /// Makes this node the root of the termination tree. The smallest leader
+  /// wins if there are several.
+  bool leader = false;
+};
+
+/// One node of the ring protocol. `Driver` defines the handle type `peer`
+/// and the type `key`, and provides the following members:
+///
+/// - `static key key_of(const peer&)` returns an identity that all nodes
+///   order the same way.
+/// - `send(to, msg, attempt)` transmits `msg`, `attempt` is 0 for the first
+///   transmission.
+/// - `send_ack(to, seq)` acknowledges message `seq` from `to`.
+/// - `schedule_digest(delay)` calls `digest_due` after `delay`.
+/// - `schedule_retransmit(delay, to, seq, attempt)` calls `retransmit_due`
+///   with the same arguments after `delay`.
+/// - `on_receive(from, msg, duplicate)`, `on_ack(to, msg, retransmits)`,
+///   `on_give_up(to, msg)`, `on_learn(peer)`, `on_all_pongs()`,
+///   `on_report(total, tree_size, is_root)`, `on_in_flight(n)` and
+///   `on_quit()` observe the protocol for logging, tracing and metrics.
+template <class Driver>
+class ring_protocol {
+public:
+  using peer = typename Driver::peer;
+  using key = typename Driver::key;
+  using message = ring_message<peer>;
+
+  ring_protocol(Driver driver, peer self, ring_config cfg)
+      : driver_(std::move(driver)),
+        self_(std::move(self)),
+        cfg_(cfg),
+        next_(),
+        has_next_(false),
+        root_(),
+        has_root_(cfg.leader),
+        received_pongs_(0),
+        reported_children_(0),
+        completed_(0),
+        in_flight_(0),
+        done_(false),
+        reported_(false),
+        shutting_down_(false),
+        digest_scheduled_(false),
+        quit_(false) {
+    known_.insert(Driver::key_of(self_));
+    learned_.push_back(self_);
+    if (has_root_)
+      root_ = self_;
+  }
+
+  Driver& driver() {
+    return driver_;
+  }
+
+  uint32_t in_flight() const {
+    return in_flight_;
+  }
+
+  bool has_quit() const {
+    return quit_;
+  }
+
+  /// Tells whether message `seq` from `from` arrived already.
+  bool received(const peer& from, uint32_t seq) const {
+    auto i = receiving_.find(Driver::key_of(from));
+    return i != receiving_.end() && i->second.count(seq) > 0;
+  }
+
+  // -- inputs -----------------------------------------------------------------
+
+  /// Starts announcing known nodes to `next`.
+  void connect(const peer& next) {
+    next_ = next;
+    has_next_ = true;
+    schedule_digest(std::chrono::milliseconds{0});
+  }
+
+  void receive(const peer& from, const message& msg) {
+    if (quit_)
+      return;
+    auto duplicate = !receiving_[Driver::key_of(from)].insert(msg.seq).second;
+    driver_.on_receive(from, msg, duplicate);
+    driver_.send_ack(from, msg.seq);
+    if (duplicate)
+      return;
+    switch (msg.kind) {
+      case ring_kind::digest: {
+        auto& version = announced_[Driver::key_of(from)];
+        version = std::max(version, msg.value);
+        pull(from);
+        break;
+      }
+      case ring_kind::pull: {
+        auto reply = make(ring_kind::share, msg.value);
+        if (msg.value < learned_.size())
+          reply.peers.assign(learned_.begin() + msg.value, learned_.end());
+        send_reliably(from, std::move(reply));
+        break;
+      }
+      case ring_kind::share: {
+        // Only a share that arrived moves the watermark, so entries of a
+        // lost pull or share get pulled again.
+        // It also answers the outstanding pull, even if its ack got lost.
+        auto k = Driver::key_of(from);
+        auto& version = pulled_[k];
+        version = std::max(version, msg.value
+                                    + static_cast<uint32_t>(msg.peers.size()));
+        pulling_.erase(k);
+        pull(from);
+        auto learned = false;
+        for (auto& x : msg.peers) {
+          if (!known_.insert(Driver::key_of(x)).second)
+            continue;
+          learned_.push_back(x);
+          others_.push_back(x);
+          driver_.on_learn(x);
+          send_reliably(x, make(ring_kind::ping));
+          learned = true;
+        }
+        if (learned)
+          schedule_digest(cfg_.digest_delay);
+        break;
+      }
+      case ring_kind::ping: {
+        auto reply = make(ring_kind::pong);
+        reply.leader = cfg_.leader;
+        send_reliably(from, std::move(reply));
+        break;
+      }
+      case ring_kind::pong:
+        // Counts nodes rather than messages, a pong sent again after a
+        // give-up must not count twice.
+        if (!ponged_.insert(Driver::key_of(from)).second)
+          break;
+        received_pongs_ += 1;
+        if (msg.leader && (!has_root_ || less(from, root_))) {
+          root_ = from;
+          has_root_ = true;
+        }
+        if (received_pongs_ >= cfg_.others && !done_) {
+          driver_.on_all_pongs();
+          // Every pong comes from a node learned through sharing, so we know
+          // all members of the tree and all leaders at this point.
+          auto members = others_;
+          members.push_back(self_);
+          tree_ = tree_type{std::move(members), cfg_.fanout,
+                            has_root_ ? &root_ : nullptr};
+          done_ = true;
+          report_done();
+        }
+        break;
+      case ring_kind::done:
+        if (!reported_by_.insert(Driver::key_of(from)).second)
+          break;
+        reported_children_ += 1;
+        completed_ += msg.value;
+        report_done();
+        break;
+      case ring_kind::shutdown:
+        broadcast_shutdown();
+        break;
+      default:
+        break;
+    }
+  }
+
+  /// Handles the ack for message `seq` to `from`. Acks for messages that
+  /// were acknowledged or given up on already are ignored.
+  void ack(const peer& from, uint32_t seq) {
+    if (quit_)
+      return;
+    auto i = unacked_.find(std::make_pair(Driver::key_of(from), seq));
+    if (i == unacked_.end())
+      return;
+    driver_.on_ack(from, i->second.msg, i->second.retransmits);
+    // The sender answers an acknowledged pull with a share. If the share
+    // gets lost, the sender announces its version again.
+    if (i->second.msg.kind == ring_kind::pull)
+      stop_pulling(from, seq);
+    unacked_.erase(i);
+    settle();
+  }
+
+  /// Sends the digest scheduled by `schedule_digest`.
+  void digest_due() {
+    digest_scheduled_ = false;
+    if (quit_ || shutting_down_ || !has_next_)
+      return;
+    send_reliably(next_, make(ring_kind::digest,
+                              static_cast<uint32_t>(learned_.size())));
+  }
+
+  /// Retransmits message `seq` to `to` unless it got an ack since the timer
+  /// for `attempt` started. The first transmission waits 200ms for the ack,
+  /// retransmits wait 500ms.
+  void retransmit_due(const peer& to, uint32_t seq, int attempt) {
+    if (quit_)
+      return;
+    auto i = unacked_.find(std::make_pair(Driver::key_of(to), seq));
+    if (i == unacked_.end() || i->second.retransmits != attempt)
+      return;
+    auto& x = i->second;
+    if (x.retransmits >= cfg_.max_retransmits) {
+      driver_.on_give_up(to, x.msg);
+      auto msg = std::move(x.msg);
+      unacked_.erase(i);
+      settle();
+      // Termination needs every node to learn, ping and report, so these
+      // messages must not get lost for good. A given-up pull starts over, a
+      // given-up digest or share makes the next node pull again. Pings,
+      // pongs and done reports go out again as new messages, which their
+      // receivers count once per sender. Only a shutdown stays given up, its
+      // receiver may have quit already.
+      switch (msg.kind) {
+        case ring_kind::pull:
+          stop_pulling(to, seq);
+          pull(to);
+          break;
+        case ring_kind::digest:
+        case ring_kind::share:
+          schedule_digest(cfg_.digest_delay);
+          break;
+        case ring_kind::ping:
+        case ring_kind::pong:
+        case ring_kind::done:
+          if (!shutting_down_)
+            send_reliably(to, std::move(msg));
+          break;
+        default:
+          break;
+      }
+      return;
+    }
+    x.retransmits += 1;
+    driver_.send(to, x.msg, x.retransmits);
+    driver_.schedule_retransmit(std::chrono::milliseconds{500}, to, seq,
+                                x.retransmits);
+  }
+
+private:
+  struct less_by_key {
+    bool operator()(const peer& x, const peer& y) const {
+      return Driver::key_of(x) < Driver::key_of(y);
+    }
+  };
+
+  using tree_type = spanning_tree<peer, less_by_key>;
+
+  /// A message waiting for its ack.
+  struct outgoing {
+    message msg;
+    int retransmits;
+  };
+
+  static bool less(const peer& x, const peer& y) {
+    return less_by_key{}(x, y);
+  }
+
+  static message make(ring_kind kind, uint32_t value = 0) {
+    return message{kind, 0, value, false, {}};
+  }
+
+  /// Pulls the entries of `from` that this node has not received yet,
+  /// unless a pull to `from` waits for its ack or this node is done.
+  void pull(const peer& from) {
+    auto k = Driver::key_of(from);
+    auto version = pulled_[k];
+    if (done_ || shutting_down_ || announced_[k] <= version
+        || pulling_.count(k) > 0)
+      return;
+    pulling_[k] = sending_[k];
+    send_reliably(from, make(ring_kind::pull, version));
+  }
+
+  /// Allows the next pull to `from` unless pull `seq` was superseded.
+  void stop_pulling(const peer& from, uint32_t seq) {
+    auto i = pulling_.find(Driver::key_of(from));
+    if (i != pulling_.end() && i->second == seq)
+      pulling_.erase(i);
+  }
+
+  void send_reliably(const peer& to, message msg) {
+    msg.seq = sending_[Driver::key_of(to)]++;
+    in_flight_ += 1;
+    driver_.on_in_flight(in_flight_);
+    auto seq = msg.seq;
+    auto& x = unacked_[std::make_pair(Driver::key_of(to), seq)];
+    x = outgoing{std::move(msg), 0};
+    driver_.send(to, x.msg, 0);
+    driver_.schedule_retransmit(std::chrono::milliseconds{200}, to, seq, 0);
+  }
+
+  /// Called whenever a message is either acknowledged or given up on.
+  void settle() {
+    in_flight_ -= 1;
+    driver_.on_in_flight(in_flight_);
+    if (shutting_down_ && in_flight_ == 0)
+      stop();
+  }
+
+  void stop() {
+    if (quit_)
+      return;
+    quit_ = true;
+    driver_.on_quit();
+  }
+
+  /// Collects newly learned nodes for `delay` before announcing the new
+  /// version to the next node, so that a burst of discoveries results in a
+  /// single digest.
+  void schedule_digest(std::chrono::milliseconds delay) {
+    if (digest_scheduled_)
+      return;
+    digest_scheduled_ = true;
+    driver_.schedule_digest(delay);
+  }
+
+  /// Sends `shutdown` to all children in the termination tree and quits as
+  /// soon as they acknowledged it. All nodes are done at this point, so
+  /// pending discovery messages no longer matter. Waiting for their acks
+  /// would only delay the shutdown, since their receivers may have quit.
+  void broadcast_shutdown() {
+    for (auto i = unacked_.begin(); i != unacked_.end();)
+      i = i->second.msg.kind == ring_kind::shutdown ? std::next(i)
+                                                    : unacked_.erase(i);
+    in_flight_ = static_cast<uint32_t>(unacked_.size());
+    for (auto& child : tree_.children(self_))
+      send_reliably(child, make(ring_kind::shutdown));
+    shutting_down_ = true;
+    driver_.on_in_flight(in_flight_);
+    if (in_flight_ == 0)
+      stop();
+  }
+
+  /// Reports completion of this subtree to the parent once this node
+  /// received all pongs and all children reported their subtrees. The root
+  /// starts the shutdown when the aggregated count covers all nodes. This
+  /// takes O(log N) hops in each direction instead of 2N hops around the
+  /// ring.
+  void report_done() {
+    if (!done_ || reported_)
+      return;
+    if (reported_children_ < tree_.children(self_).size())
+      return;
+    reported_ = true;
+    auto total = completed_ + 1;
+    auto is_root = tree_.is_root(self_);
+    driver_.on_report(total, tree_.size(), is_root);
+    if (is_root) {
+      if (total >= tree_.size())
+        broadcast_shutdown();
+    } else {
+      send_reliably(tree_.parent(self_), make(ring_kind::done, total));
+    }
+  }
+
+  Driver driver_;
+  peer self_;
+  ring_config cfg_;
+  peer next_;
+  bool has_next_;
+  /// Smallest node started as leader, root of the termination tree.
+  peer root_;
+  bool has_root_;
+  /// Identities of all known nodes, including this one.
+  std::set<key> known_;
+  /// All known nodes in the order this node learned them, starting with
+  /// itself. The size is the version announced in digests.
+  std::vector<peer> learned_;
+  std::vector<peer> others_;
+  /// The highest version announced by each node that sent a digest.
+  std::map<key, uint32_t> announced_;
+  /// The number of entries received from each node through shares.
+  std::map<key, uint32_t> pulled_;
+  /// Nodes that sent a pong or a done report to this node.
+  std::set<key> ponged_;
+  std::set<key> reported_by_;
+  /// Sequence number of the pull to each node that waits for its ack or
+  /// share.
+  std::map<key, uint32_t> pulling_;
+  tree_type tree_;
+  uint32_t received_pongs_;
+  uint32_t reported_children_;
+  uint32_t completed_;
+  uint32_t in_flight_;
+  bool done_;
+  bool reported_;
+  bool shutting_down_;
+  bool digest_scheduled_;
+  bool quit_;
+  std::map<key, uint32_t> sending_;
+  std::map<key, std::set<uint32_t>> receiving_;
+  std::map<std::pair<key, uint32_t>, outgoing> unacked_;
+};
+
+#endif // RING_PROTOCOL_HPP
@@ -0,0 +1,203 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// -----------------------------------------------------------------------------
+//  SHARED MEMORY RING BUFFER
+// -----------------------------------------------------------------------------
+
+/// Single-producer, single-consumer ring of length-prefixed messages in a
+/// POSIX shared memory segment. Writer and reader run in different processes
+/// on the same host and exchange messages without syscalls or copies through
+/// the kernel. Each side only writes its own position, the other side reads
+/// it with acquire semantics. Messages never wrap around the end of the
+/// buffer: a message that does not fit before the end starts at offset 0 and
+/// the writer marks the skipped tail with a length of `wrap`.
+class shm_ring {
+public:
+  shm_ring() : fd_(-1), size_(0), hdr_(nullptr), data_(nullptr) {
+    // nop
+  }
+
+  shm_ring(const shm_ring&) = delete;
+  shm_ring& operator=(const shm_ring&) = delete;
+
+  ~shm_ring() {
+    close();
+  }
+
+  /// Creates the segment `name` with room for `capacity` bytes of messages,
+  /// replacing a segment that a crashed process left behind. `capacity` must
+  /// be a power of two. Another process may attach with `open` as soon as
+  /// this returns.
+  bool create(const std::string& name, size_t capacity) {
+    close();
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+      return false;
+    shm_unlink(name.c_str());
+    fd_ = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd_ < 0)
+      return false;
+    size_ = sizeof(header) + capacity;
+    if (ftruncate(fd_, static_cast<off_t>(size_)) != 0 || !map()) {
+      close();
+      return false;
+    }
+    // The segment starts out zeroed, so a reader that attaches before this
+    // point sees `ready == 0` and retries.
+    hdr_->capacity = capacity;
+    hdr_->head.store(0, std::memory_order_relaxed);
+    hdr_->tail.store(0, std::memory_order_relaxed);
+    hdr_->ready.store(1, std::memory_order_release);
+    name_ = name;
+    return true;
+  }
+
+  /// Attaches to a segment made by `create`, possibly in another process.
+  /// Returns `false` if the segment does not exist or is not initialized
+  /// yet, so the caller may retry.
+  bool open(const std::string& name) {
+    close();
+    fd_ = shm_open(name.c_str(), O_RDWR, 0600);
+    if (fd_ < 0)
+      return false;
+    struct stat st;
+    if (fstat(fd_, &st) != 0
+        || static_cast<size_t>(st.st_size) <= sizeof(header)) {
+      close();
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (!map() || hdr_->ready.load(std::memory_order_acquire) == 0) {
+      close();
+      return false;
+    }
+    name_ = name;
+    return true;
+  }
+
+  /// Removes the name of the segment. Attached processes keep their mapping.
+  /// Either side may call this once both attached.
+  void unlink() {
+    if (!name_.empty())
+      shm_unlink(name_.c_str());
+    name_.clear();
+  }
+
+  void close() {
+    if (hdr_ != nullptr)
+      munmap(hdr_, size_);
+    if (fd_ >= 0)
+      ::close(fd_);
+    fd_ = -1;
+    hdr_ = nullptr;
+    data_ = nullptr;
+  }
+
+  bool valid() const {
+    return hdr_ != nullptr;
+  }
+
+  /// Returns the largest message `try_write` accepts.
+  size_t max_message_size() const {
+    return hdr_->capacity / 2 - sizeof(uint32_t);
+  }
+
+  /// Appends a message. Returns `false` without blocking if the reader did
+  /// not make enough room yet.
+  bool try_write(const void* buf, size_t len) {
+    if (len > max_message_size())
+      return false;
+    auto cap = hdr_->capacity;
+    auto head = hdr_->head.load(std::memory_order_relaxed);
+    auto tail = hdr_->tail.load(std::memory_order_acquire);
+    auto offset = head & (cap - 1);
+    auto needed = record_size(len);
+    auto skip = offset + needed > cap ? cap - offset : 0;
+    if (head + skip + needed - tail > cap)
+      return false;
+    if (skip > 0) {
+      store_length(offset, wrap);
+      head += skip;
+      offset = 0;
+    }
+    store_length(offset, static_cast<uint32_t>(len));
+    memcpy(data_ + offset + sizeof(uint32_t), buf, len);
+    hdr_->head.store(head + needed, std::memory_order_release);
+    return true;
+  }
+
+  /// Takes the next message into `buf` and returns its size, returns 0 if the
+  /// ring is empty. `buf` must hold `max_message_size()` bytes.
+  size_t try_read(void* buf) {
+    auto cap = hdr_->capacity;
+    auto tail = hdr_->tail.load(std::memory_order_relaxed);
+    auto head = hdr_->head.load(std::memory_order_acquire);
+    if (tail == head)
+      return 0;
+    auto offset = tail & (cap - 1);
+    auto len = load_length(offset);
+    if (len == wrap) {
+      tail += cap - offset;
+      offset = 0;
+      len = load_length(offset);
+    }
+    memcpy(buf, data_ + offset + sizeof(uint32_t), len);
+    hdr_->tail.store(tail + record_size(len), std::memory_order_release);
+    return len;
+  }
+
+private:
+  static constexpr uint32_t wrap = 0xFFFFFFFF;
+
+  /// Keeps both positions on their own cache line, so that writer and reader
+  /// do not invalidate each other's line on every message.
+  struct header {
+    alignas(64) std::atomic<uint64_t> head;
+    alignas(64) std::atomic<uint64_t> tail;
+    alignas(64) uint64_t capacity;
+    std::atomic<uint32_t> ready;
+  };
+
+  static size_t record_size(size_t len) {
+    // Keep the length prefixes aligned.
+    return (sizeof(uint32_t) + len + 7) & ~size_t{7};
+  }
+
+  bool map() {
+    auto ptr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (ptr == MAP_FAILED)
+      return false;
+    hdr_ = static_cast<header*>(ptr);
+    data_ = static_cast<char*>(ptr) + sizeof(header);
+    return true;
+  }
+
+  void store_length(uint64_t offset, uint32_t len) {
+    memcpy(data_ + offset, &len, sizeof(len));
+  }
+
+  uint32_t load_length(uint64_t offset) const {
+    uint32_t len;
+    memcpy(&len, data_ + offset, sizeof(len));
+    return len;
+  }
+
+  int fd_;
+  size_t size_;
+  header* hdr_;
+  char* data_;
+  std::string name_;
+};
+
+#endif // SHM_RING_HPP
@@ -0,0 +1,462 @@
+#ifndef SIMULATOR_HPP
+#define SIMULATOR_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+#include "fec.hpp"
+#include "ring_protocol.hpp"
+
+// -----------------------------------------------------------------------------
+//  DISCRETE-EVENT SIMULATION OF THE PING PROTOCOL
+// -----------------------------------------------------------------------------
+
+// Runs the protocol of `ping` on a virtual clock instead of sockets. Each node
+// is the same `ring_protocol` state machine that `ping` drives with actors,
+// here driven by events of the simulation: messages, acks and parity travel
+// as `sim_packet` values through a network model with latency, jitter and
+// loss, and timers are events at a later virtual time. Events at the same
+// virtual time run in the order they were scheduled and all randomness comes
+// from one seeded generator, so a run is reproducible from its seed.
+
+/// Virtual time in microseconds.
+using sim_time = int64_t;
+
+constexpr sim_time sim_ms = 1000;
+
+struct network_model {
+  /// Minimum one-way delay.
+  double latency_ms = 0.5;
+  /// Mean of the exponentially distributed delay on top of the minimum.
+  double jitter_ms = 0.1;
+  /// Delivers datagrams between two nodes in the order they were sent, as
+  /// on a single network path or a stream connection. Otherwise, jitter may
+  /// reorder them, as for UDP.
+  bool ordered = false;
+  /// Probability that a datagram (including acks) gets lost.
+  double loss = 0.;
+  /// Time a node needs to handle one message. Nodes handle one message at a
+  /// time, so this also models queueing in the mailbox.
+  double cpu_us = 5.;
+};
+
+/// Rows of `sim_stats`: the message kinds of `ring_kind` in the same order,
+/// followed by the packets that only exist on the wire.
+enum class sim_kind {
+  digest,
+  pull,
+  share,
+  ping,
+  pong,
+  done,
+  shutdown,
+  /// XOR parity over a group of messages, see `enable_fec`.
+  parity,
+  ack,
+  num_kinds
+};
+
+inline const char* to_string(sim_kind x) {
+  static constexpr const char* names[] = {
+    "digest", "pull", "share", "ping", "pong", "done", "shutdown", "parity",
+    "ack"
+  };
+  return names[static_cast<size_t>(x)];
+}
+
+inline sim_kind to_sim_kind(ring_kind x) {
+  return static_cast<sim_kind>(x);
+}
+
+using sim_message = ring_message<uint32_t>;
+
+/// A datagram between two simulated nodes.
+struct sim_packet {
+  sim_kind kind;
+  /// The protocol message, or only the sequence number of an ack or of the
+  /// first message covered by a parity.
+  sim_message msg;
+  /// Number of messages covered by a parity.
+  uint32_t count;
+  /// XOR of the encoded messages covered by a parity.
+  std::vector<char> parity;
+};
+
+/// Encodes a protocol message for the parity, with fixed-width fields in
+/// little-endian byte order like the binary serializer of CAF.
+inline std::vector<char> encode(const sim_message& x) {
+  std::vector<char> buf;
+  auto put = [&](uint32_t y) {
+    for (size_t i = 0; i < 4; ++i)
+      buf.push_back(static_cast<char>((y >> (8 * i)) & 0xFF));
+  };
+  buf.push_back(static_cast<char>(x.kind));
+  put(x.seq);
+  put(x.value);
+  buf.push_back(x.leader ? 1 : 0);
+  put(static_cast<uint32_t>(x.peers.size()));
+  for (auto peer : x.peers)
+    put(peer);
+  return buf;
+}
+
+/// Decodes the output of `encode`. Returns `false` for malformed input.
+inline bool decode(const std::vector<char>& buf, sim_message& x) {
+  size_t pos = 0;
+  auto get = [&](uint32_t& y) {
+    if (buf.size() - pos < 4)
+      return false;
+    y = 0;
+    for (size_t i = 0; i < 4; ++i)
+      y |= static_cast<uint32_t>(static_cast<unsigned char>(buf[pos++]))
+           << (8 * i);
+    return true;
+  };
+  uint32_t n = 0;
+  if (buf.size() < 10
+      || static_cast<unsigned char>(buf[0])
+           >= static_cast<unsigned char>(ring_kind::num_kinds))
+    return false;
+  x.kind = static_cast<ring_kind>(buf[pos++]);
+  if (!get(x.seq) || !get(x.value) || pos >= buf.size())
+    return false;
+  x.leader = buf[pos++] != 0;
+  if (!get(n) || n > (buf.size() - pos) / 4)
+    return false;
+  x.peers.resize(n);
+  for (auto& peer : x.peers)
+    get(peer);
+  return pos == buf.size();
+}
+
+struct sim_stats {
+  static constexpr size_t num_kinds = static_cast<size_t>(sim_kind::num_kinds);
+  /// First transmissions per message kind.
+  std::array<uint64_t, num_kinds> sent{};
+  std::array<uint64_t, num_kinds> retransmits{};
+  std::array<uint64_t, num_kinds> lost{};
+  std::array<uint64_t, num_kinds> duplicates{};
+  /// Messages given up on after the maximum number of retransmits.
+  uint64_t failures = 0;
+  /// Messages that arrived after the receiver quit. They get no ack.
+  uint64_t dropped = 0;
+  /// Messages rebuilt from a parity instead of waiting for a retransmit.
+  uint64_t recovered = 0;
+  uint64_t events = 0;
+  uint32_t nodes_done = 0;
+  uint32_t nodes_quit = 0;
+  /// Time when the last node received all pongs.
+  sim_time all_pongs = 0;
+  /// Time when the last node quit, valid if all nodes quit.
+  sim_time completion = 0;
+};
+
+/// Runs callbacks in order of their virtual time.
+class event_queue {
+public:
+  event_queue() : now_(0), order_(0) {
+    // nop
+  }
+
+  sim_time now() const {
+    return now_;
+  }
+
+  void schedule(sim_time at, std::function<void()> f) {
+    events_.push(event{at, order_++, std::move(f)});
+  }
+
+  /// Runs events until none are left or the next one is after `deadline`.
+  /// Returns the number of events that ran.
+  uint64_t run(sim_time deadline) {
+    uint64_t n = 0;
+    while (!events_.empty() && events_.top().at <= deadline) {
+      auto f = std::move(const_cast<event&>(events_.top()).f);
+      now_ = events_.top().at;
+      events_.pop();
+      f();
+      ++n;
+    }
+    return n;
+  }
+
+private:
+  struct event {
+    sim_time at;
+    uint64_t order;
+    std::function<void()> f;
+
+    bool operator<(const event& other) const {
+      // std::priority_queue returns the largest element first.
+      return at != other.at ? at > other.at : order > other.order;
+    }
+  };
+
+  sim_time now_;
+  uint64_t order_;
+  std::priority_queue<event> events_;
+};
+
+class ring_simulation {
+public:
+  /// Simulates `nodes` nodes running the protocol with `cfg`. The number of
+  /// other nodes in `cfg` is ignored.
+  ring_simulation(uint32_t nodes, ring_config cfg, network_model net,
+                  uint64_t seed)
+      : fec_group_(0),
+        fec_delay_(0),
+        net_(net),
+        rng_(seed),
+        hosts_(nodes) {
+    cfg.others = nodes > 0 ? nodes - 1 : 0;
+    nodes_.reserve(nodes);
+    for (uint32_t i = 0; i < nodes; ++i)
+      nodes_.emplace_back(driver{this, i}, i, cfg);
+  }
+
+  /// Sends a parity message after every `group` reliable messages to the
+  /// same node, or `delay` after the first message of an incomplete group.
+  /// A receiver missing exactly one message of a group rebuilds it from the
+  /// parity bytes and the messages it got, with the same `fec_encoder` and
+  /// `fec_decoder` as `pong`.
+  void enable_fec(uint32_t group, sim_time delay) {
+    fec_group_ = group;
+    fec_delay_ = delay;
+  }
+
+  /// Connects every node to its successor at time 0 and runs until all nodes
+  /// quit or the virtual time exceeds `deadline`.
+  sim_stats run(sim_time deadline) {
+    auto n = static_cast<uint32_t>(nodes_.size());
+    for (uint32_t i = 0; i < n; ++i)
+      events_.schedule(0, [=] { nodes_[i].connect((i + 1) % n); });
+    stats_.events = events_.run(deadline);
+    return stats_;
+  }
+
+private:
+  /// Connects a node to the simulation. Nodes are identified by their index.
+  struct driver {
+    using peer = uint32_t;
+    using key = uint32_t;
+
+    ring_simulation* sim;
+    uint32_t self;
+
+    static uint32_t key_of(uint32_t x) {
+      return x;
+    }
+
+    void send(uint32_t to, const sim_message& msg, int attempt) {
+      auto kind = index(to_sim_kind(msg.kind));
+      if (attempt == 0) {
+        sim->stats_.sent[kind] += 1;
+        if (sim->fec_group_ > 0)
+          sim->fec_add(self, to, msg);
+      } else {
+        sim->stats_.retransmits[kind] += 1;
+      }
+      sim->transmit(self, to, sim_packet{to_sim_kind(msg.kind), msg, 0, {}});
+    }
+
+    void send_ack(uint32_t to, uint32_t seq) {
+      sim->stats_.sent[index(sim_kind::ack)] += 1;
+      sim->transmit(self, to,
+                    sim_packet{sim_kind::ack,
+                               sim_message{ring_kind::ping, seq, 0, false, {}},
+                               0, {}});
+    }
+
+    void schedule_digest(std::chrono::milliseconds delay) {
+      auto id = self;
+      auto s = sim;
+      s->after(delay, [=] { s->nodes_[id].digest_due(); });
+    }
+
+    void schedule_retransmit(std::chrono::milliseconds delay, uint32_t to,
+                             uint32_t seq, int attempt) {
+      auto id = self;
+      auto s = sim;
+      s->after(delay,
+               [=] { s->nodes_[id].retransmit_due(to, seq, attempt); });
+    }
+
+    void on_receive(uint32_t, const sim_message& msg, bool duplicate) {
+      if (duplicate)
+        sim->stats_.duplicates[index(to_sim_kind(msg.kind))] += 1;
+    }
+
+    void on_ack(uint32_t, const sim_message&, int) {
+      // nop
+    }
+
+    void on_give_up(uint32_t, const sim_message&) {
+      sim->stats_.failures += 1;
+    }
+
+    void on_learn(uint32_t) {
+      // nop
+    }
+
+    void on_all_pongs() {
+      sim->stats_.nodes_done += 1;
+      sim->stats_.all_pongs = sim->events_.now();
+    }
+
+    void on_report(uint32_t, size_t, bool) {
+      // nop
+    }
+
+    void on_in_flight(uint32_t) {
+      // nop
+    }
+
+    void on_quit() {
+      auto& stats = sim->stats_;
+      stats.nodes_quit += 1;
+      if (stats.nodes_quit == sim->nodes_.size())
+        stats.completion = sim->events_.now();
+    }
+  };
+
+  /// Parity of the group currently sent to one node.
+  struct fec_group_state {
+    fec_encoder parity;
+    uint32_t first = 0;
+  };
+
+  /// What the simulation keeps per node besides the protocol state.
+  struct host {
+    sim_time busy_until = 0;
+    std::unordered_map<uint32_t, fec_group_state> fec_out;
+    std::unordered_map<uint32_t, fec_decoder> fec_in;
+  };
+
+  static size_t index(sim_kind x) {
+    return static_cast<size_t>(x);
+  }
+
+  static uint64_t link_key(uint32_t from, uint32_t to) {
+    return (static_cast<uint64_t>(from) << 32) | to;
+  }
+
+  template <class F>
+  void after(std::chrono::milliseconds delay, F f) {
+    events_.schedule(events_.now() + delay.count() * sim_ms, std::move(f));
+  }
+
+  // -- network ----------------------------------------------------------------
+
+  /// Puts a datagram on the wire. It either gets lost or arrives after the
+  /// network delay, then waits until the receiver is idle.
+  void transmit(uint32_t from, uint32_t to, sim_packet x) {
+    if (std::bernoulli_distribution{net_.loss}(rng_)) {
+      stats_.lost[index(x.kind)] += 1;
+      return;
+    }
+    auto delay = net_.latency_ms * sim_ms;
+    if (net_.jitter_ms > 0)
+      delay += std::exponential_distribution<double>{1. / net_.jitter_ms}(rng_)
+               * sim_ms;
+    auto arrival = events_.now() + static_cast<sim_time>(delay);
+    if (net_.ordered) {
+      auto& last = last_arrival_[link_key(from, to)];
+      arrival = std::max(arrival, last);
+      last = arrival;
+    }
+    // Shares and parities can be large, share them between the events
+    // instead of copying them.
+    auto ptr = std::make_shared<const sim_packet>(std::move(x));
+    events_.schedule(arrival, [=] {
+      auto& dst = hosts_[to];
+      auto start = std::max(events_.now(), dst.busy_until);
+      dst.busy_until = start + static_cast<sim_time>(net_.cpu_us);
+      events_.schedule(dst.busy_until, [=] { deliver(to, from, *ptr); });
+    });
+  }
+
+  void deliver(uint32_t self, uint32_t from, const sim_packet& x) {
+    auto& node = nodes_[self];
+    if (node.has_quit()) {
+      if (x.kind != sim_kind::ack && x.kind != sim_kind::parity)
+        stats_.dropped += 1;
+      return;
+    }
+    switch (x.kind) {
+      case sim_kind::ack:
+        node.ack(from, x.msg.seq);
+        break;
+      case sim_kind::parity:
+        fec_recover(self, from, x);
+        break;
+      default:
+        if (fec_group_ > 0 && !node.received(from, x.msg.seq))
+          hosts_[self].fec_in[from].add(x.msg.seq, encode(x.msg));
+        node.receive(from, x.msg);
+    }
+  }
+
+  // -- forward error correction -----------------------------------------------
+
+  void fec_add(uint32_t from, uint32_t to, const sim_message& msg) {
+    auto& out = hosts_[from].fec_out[to];
+    if (out.parity.count() == 0) {
+      auto seq = msg.seq;
+      out.first = seq;
+      events_.schedule(events_.now() + fec_delay_, [=] {
+        auto& out = hosts_[from].fec_out[to];
+        if (out.parity.count() > 0 && out.first == seq)
+          fec_flush(from, to);
+      });
+    }
+    out.parity.add(encode(msg));
+    if (out.parity.count() >= fec_group_)
+      fec_flush(from, to);
+  }
+
+  void fec_flush(uint32_t from, uint32_t to) {
+    auto& out = hosts_[from].fec_out[to];
+    stats_.sent[index(sim_kind::parity)] += 1;
+    auto count = out.parity.count();
+    transmit(from, to,
+             sim_packet{sim_kind::parity,
+                        sim_message{ring_kind::ping, out.first, 0, false, {}},
+                        count, out.parity.take()});
+  }
+
+  /// Rebuilds the single message of a parity group that did not arrive yet.
+  void fec_recover(uint32_t self, uint32_t from, const sim_packet& x) {
+    auto& node = nodes_[self];
+    uint32_t seq = 0;
+    std::vector<char> buf;
+    sim_message msg;
+    if (!hosts_[self].fec_in[from].recover(x.msg.seq, x.count, x.parity, seq,
+                                           buf)
+        || node.received(from, seq) || !decode(buf, msg) || msg.seq != seq)
+      return;
+    stats_.recovered += 1;
+    node.receive(from, msg);
+  }
+
+  std::vector<ring_protocol<driver>> nodes_;
+  uint32_t fec_group_;
+  sim_time fec_delay_;
+  network_model net_;
+  std::mt19937_64 rng_;
+  event_queue events_;
+  sim_stats stats_;
+  std::vector<host> hosts_;
+  /// Latest arrival time on each link by `(sender << 32) | receiver`, only
+  /// used if the network model keeps links ordered.
+  std::unordered_map<uint64_t, sim_time> last_arrival_;
+};
+
+#endif // SIMULATOR_HPP
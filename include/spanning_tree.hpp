@@ -0,0 +1,82 @@
+#ifndef SPANNING_TREE_HPP
+#define SPANNING_TREE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// -----------------------------------------------------------------------------
+//  SPANNING TREE
+// -----------------------------------------------------------------------------
+
+/// Arranges a set of nodes in a k-ary tree for aggregating completion reports
+/// and broadcasting control messages. Members are sorted by `Less`, which must
+/// order them the same way on every node, so every node computes the same
+/// tree from the same member set without any further coordination. The
+/// smallest member becomes the root unless the caller names a different one.
+/// A fan-out of 0 attaches all members directly to the root.
+template <class T, class Less = std::less<T>>
+class spanning_tree {
+public:
+  spanning_tree() : fanout_(0) {
+    // nop
+  }
+
+  /// Builds the tree over `members`. A `root` that is one of the members
+  /// replaces the smallest member as root.
+  spanning_tree(std::vector<T> members, size_t fanout,
+                const T* root = nullptr)
+      : members_(std::move(members)),
+        fanout_(fanout) {
+    std::sort(members_.begin(), members_.end(), Less{});
+    if (root == nullptr)
+      return;
+    auto i = std::find(members_.begin(), members_.end(), *root);
+    if (i != members_.end())
+      std::rotate(members_.begin(), i, i + 1);
+  }
+
+  size_t size() const {
+    return members_.size();
+  }
+
+  bool is_root(const T& x) const {
+    return !members_.empty() && members_.front() == x;
+  }
+
+  /// Returns the parent of `x` or a default-constructed value for the root.
+  T parent(const T& x) const {
+    auto i = index_of(x);
+    if (i == 0 || i >= members_.size())
+      return T{};
+    return members_[fanout_ == 0 ? 0 : (i - 1) / fanout_];
+  }
+
+  std::vector<T> children(const T& x) const {
+    std::vector<T> result;
+    auto i = index_of(x);
+    if (i >= members_.size())
+      return result;
+    if (fanout_ == 0) {
+      if (i == 0)
+        result.insert(result.end(), members_.begin() + 1, members_.end());
+      return result;
+    }
+    for (size_t j = i * fanout_ + 1;
+         j <= i * fanout_ + fanout_ && j < members_.size(); ++j)
+      result.push_back(members_[j]);
+    return result;
+  }
+
+private:
+  size_t index_of(const T& x) const {
+    auto i = std::find(members_.begin(), members_.end(), x);
+    return static_cast<size_t>(std::distance(members_.begin(), i));
+  }
+
+  std::vector<T> members_;
+  size_t fanout_;
+};
+
+#endif // SPANNING_TREE_HPP
@@ -0,0 +1,111 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "clock_offset.hpp"
+
+// -----------------------------------------------------------------------------
+//  CAUSAL TRACING
+// -----------------------------------------------------------------------------
+
+/// Records protocol events of one node as JSON lines for offline analysis
+/// with `bench/critical_path.py`. A message is identified by sender, receiver
+/// and the sequence number assigned by `send_reliably`, so both ends derive the
+/// same ID without shipping it. Every send names the message whose handler
+/// caused it as parent, which links the traces of all nodes into one causal
+/// graph. Timestamps come from `clock_now()` and assume synchronized clocks
+/// (e.g., all nodes on one host or NTP).
+class tracer {
+public:
+  /// Starts tracing to `path` and logs the `start` event. Does nothing for an
+  /// empty path.
+  bool open(const std::string& path, uint64_t node, const std::string& name) {
+    if (path.empty())
+      return true;
+    out_.open(path);
+    if (!out_)
+      return false;
+    out_ << "{\"event\":\"start\",\"t\":" << clock_now()
+         << ",\"node\":\"" << hex(node) << "\",\"name\":\"" << escape(name)
+         << "\"}\n";
+    return true;
+  }
+
+  bool enabled() const {
+    return out_.is_open();
+  }
+
+  /// Returns the ID of the `seq`-th message from `from` to `to`.
+  static std::string id(uint64_t from, uint64_t to, uint32_t seq) {
+    return hex(from) + "-" + hex(to) + "-" + std::to_string(seq);
+  }
+
+  void send(const std::string& id, const std::string& parent,
+            const char* type) {
+    out_ << "{\"event\":\"send\",\"t\":" << clock_now() << ",\"id\":\"" << id
+         << "\",\"parent\":\"" << parent << "\",\"type\":\"" << type
+         << "\"}\n";
+  }
+
+  void retransmit(const std::string& id) {
+    event("retransmit", id);
+  }
+
+  void ack(const std::string& id) {
+    event("ack", id);
+  }
+
+  void receive(const std::string& id, const char* type, bool duplicate) {
+    out_ << "{\"event\":\"receive\",\"t\":" << clock_now() << ",\"id\":\""
+         << id << "\",\"type\":\"" << type << "\",\"duplicate\":"
+         << (duplicate ? "true" : "false") << "}\n";
+  }
+
+  /// Logs that handling `trigger` completed a wait for all of `waits`, e.g.,
+  /// the last pong of a node. Lets the analyzer compute the slack of the
+  /// other messages in `waits`.
+  void join(const std::string& trigger, const std::vector<std::string>& waits) {
+    out_ << "{\"event\":\"join\",\"t\":" << clock_now() << ",\"id\":\""
+         << trigger << "\",\"waits\":[";
+    for (size_t i = 0; i < waits.size(); ++i)
+      out_ << (i > 0 ? ",\"" : "\"") << waits[i] << "\"";
+    out_ << "]}\n";
+  }
+
+  void flush() {
+    if (enabled())
+      out_.flush();
+  }
+
+private:
+  void event(const char* name, const std::string& id) {
+    out_ << "{\"event\":\"" << name << "\",\"t\":" << clock_now()
+         << ",\"id\":\"" << id << "\"}\n";
+  }
+
+  static std::string hex(uint64_t x) {
+    static constexpr char digits[] = "0123456789abcdef";
+    std::string result(16, '0');
+    for (auto i = result.rbegin(); i != result.rend(); ++i, x >>= 4)
+      *i = digits[x & 0xF];
+    return result;
+  }
+
+  static std::string escape(const std::string& x) {
+    std::string result;
+    for (auto c : x) {
+      if (c == '"' || c == '\\')
+        result += '\\';
+      result += c;
+    }
+    return result;
+  }
+
+  std::ofstream out_;
+};
+
+#endif // TRACE_HPP
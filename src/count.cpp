@@ -1,10 +1,25 @@
+#include <atomic>
 #include <chrono>
+#include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
 
 #include <caf/all.hpp>
 #include <caf/io/all.hpp>
 
+#include "backoff.hpp"
+#include "clock_offset.hpp"
+#include "message_stash.hpp"
+#include "online_stats.hpp"
+#include "pacing.hpp"
+#include "peer_cache.hpp"
+#include "perf_counters.hpp"
+#include "placement.hpp"
+
 using namespace caf;
 using namespace caf::io;
 
@@ -12,12 +27,22 @@ namespace {
 
 using ack_atom = caf::atom_constant<atom("ack")>;
 using tag_atom = caf::atom_constant<atom("tag")>;
+using contact_atom = caf::atom_constant<atom("contact")>;
 using done_atom = caf::atom_constant<atom("done")>;
+using fail_atom = caf::atom_constant<atom("fail")>;
+using hello_atom = caf::atom_constant<atom("hello")>;
+using pace_atom = caf::atom_constant<atom("pace")>;
 using ping_atom = caf::atom_constant<atom("ping")>;
 using pong_atom = caf::atom_constant<atom("pong")>;
+using restore_atom = caf::atom_constant<atom("restore")>;
+using seed_atom = caf::atom_constant<atom("seed")>;
+using sync_atom = caf::atom_constant<atom("sync")>;
 using share_atom = caf::atom_constant<atom("share")>;
+using stale_atom = caf::atom_constant<atom("stale")>;
 using measure_atom = caf::atom_constant<atom("measure")>;
 using shutdown_atom = caf::atom_constant<atom("shutdown")>;
+using timeout_atom = caf::atom_constant<atom("timeout")>;
+using warm_atom = caf::atom_constant<atom("warm")>;
 
 // -----------------------------------------------------------------------------
 //  ACTOR SYSTEM CONFIG
@@ -27,13 +52,33 @@ class configuration : public actor_system_config {
 public:
   std::string host = "localhost";
   std::string name = "";
+  std::string stash_policy = "backpressure";
+  std::string results = "";
+  std::string perf_results = "";
+  std::string peer_cache = "";
+  std::string advertise = "localhost";
+  std::string seeds = "";
   uint16_t port = 12345;
   uint16_t local_port = 0;
   uint16_t offset = 0;
   uint32_t others = 7;
   uint32_t timeout = 0;
   int rounds = 3;
+  int sync_rounds = 10;
+  placement pin;
+  uint32_t stash_capacity = 1024;
+  uint32_t window = 0;
+  uint32_t max_window = 64;
+  uint32_t pace_rate = 0;
+  uint32_t pace_burst = 16;
+  uint32_t stats_batch = 32;
+  uint32_t connect_deadline = 30;
+  uint32_t backoff_initial = 50;
+  uint32_t backoff_max = 2000;
+  double warmup_tolerance = .1;
+  double ci_target = 0.;
   bool leader = false;
+  bool prewarm = false;
   configuration() {
     load<io::middleman>();
     opt_group{custom_options_,         "global"}
@@ -46,70 +91,524 @@ public:
       .add(timeout,    "timeout,t",    "use a timeout (sec) instead of user "
                                        "input")
       .add(name,       "name,n",       "name used for debugging")
-      .add(rounds,     "rounds,r",     "number of measurement rounds")
+      .add(rounds,     "rounds,r",     "(maximum) number of measurement "
+                                       "rounds")
+      .add(ci_target,  "ci-target",    "stop measuring once the 95% CI of "
+                                       "the mean RTT is within this fraction "
+                                       "of the mean (0 = run all rounds)")
+      .add(stats_batch,"stats-batch",  "RTT samples per batch for warm-up "
+                                       "detection and confidence intervals")
+      .add(warmup_tolerance,"warmup-tolerance","maximum relative difference "
+                                       "of two batch means that ends the "
+                                       "warm-up")
+      .add(sync_rounds,"sync-rounds,s","number of clock offset probes per node")
+      .add(results,    "results",      "write machine-readable results (JSON) "
+                                       "to this file")
+      .add(perf_results,"perf-results","record performance counters per "
+                                       "phase and write them to this file")
+      .add(stash_capacity,"stash-capacity","maximum number of messages kept "
+                                       "before the ring is wired")
+      .add(stash_policy,"stash-policy","what to do with early messages when "
+                                       "the stash is full (drop, nack, "
+                                       "backpressure)")
+      .add(window,     "window",       "initial number of unanswered pings "
+                                       "per node (0 = unlimited)")
+      .add(max_window, "max-window",   "maximum congestion window per node")
+      .add(pace_rate,  "pace-rate",    "maximum pings per second to all "
+                                       "nodes (0 = unlimited)")
+      .add(pace_burst, "pace-burst",   "pings that may leave at once when "
+                                       "pacing")
+      .add(peer_cache, "peer-cache",   "connect to the nodes in this file "
+                                       "directly and store all known nodes "
+                                       "in it on shutdown")
+      .add(advertise,  "advertise",    "host name under which other nodes "
+                                       "reach this node")
+      .add(seeds,      "seeds",        "nodes (host:port,...) to contact in "
+                                       "parallel to the next node")
+      .add(connect_deadline,"connect-deadline","time (s) to keep retrying "
+                                       "connections during startup")
+      .add(backoff_initial,"backoff-initial","time (ms) before the first "
+                                       "retry, doubles with each retry")
+      .add(backoff_max,"backoff-max",  "maximum time (ms) between retries")
+      .add(prewarm,    "prewarm",      "connect to a node as soon as its "
+                                       "actor arrives instead of with the "
+                                       "first message")
       .add(others,     "others,o",     "set number of other nodes");
+    pin.add_options(custom_options_);
   }
 };
 
+/// One-way delays of all answered pings to a single node (in ns).
+struct delays {
+  std::vector<int64_t> forward;
+  std::vector<int64_t> backward;
+};
+
 struct cache {
+  message_stash early;
+  std::string host;
+  uint16_t port;
+  /// Host and port of all other nodes, only complete for nodes that shared
+  /// their actor with this node.
+  std::unordered_map<std::string, peer_contact> contacts;
+  bool connected;
+  /// Cached nodes that were reached or found stale.
+  std::set<std::string> cache_resolved;
+  /// Whether all resolved cached nodes still run under their cached IDs.
+  bool cache_current;
+  /// Whether the own ring share waits for the peer cache to resolve.
+  bool share_pending;
+  /// Ring shares of other nodes that arrived before the next node was
+  /// reached, forwarded once it is.
+  std::vector<std::pair<actor, peer_contact>> held_shares;
+  send_queue<std::string> pacing;
+  bool pump_scheduled;
+  /// Rounds of pings per node that wait for a pong, only tracked when pacing.
+  std::unordered_map<std::string, std::set<int>> outstanding;
+  /// Rounds of pings per node that timed out and may still get a late pong.
+  std::unordered_map<std::string, std::set<int>> overdue;
+  /// Timeout per node, derived from its RTTs.
+  std::unordered_map<std::string, rtt_estimator> timeouts;
+  size_t pings_lost;
+  size_t pongs_late;
   actor next;
   std::unordered_map<std::string, actor> others;
   std::unordered_map<std::string, std::set<int>> answers;
+  std::unordered_map<std::string, clock_offset> clocks;
+  std::unordered_map<std::string, delays> latencies;
+  std::vector<int64_t> rtts;
+  /// RTT of the first exchange with each node, which includes connection
+  /// setup unless it was prewarmed.
+  std::unordered_map<std::string, int64_t> first_rtts;
+  /// RTTs in microseconds, updated with every pong.
+  stream_summary rtt;
+  std::unordered_map<std::string, size_t> pings_to;
+  int rounds_measured;
+  bool conclusive;
+  size_t pings_sent;
+  size_t pings_received;
+  int64_t measure_begin;
+  int64_t measure_end;
+  /// Start of each round and arrival of its last pong. Throughput only
+  /// counts these spans, not the pause between rounds.
+  std::map<int, std::pair<int64_t, int64_t>> round_spans;
 };
 
+/// Returns the `q`-quantile of the sorted samples `xs` in microseconds.
+double percentile_us(const std::vector<int64_t>& xs, double q) {
+  if (xs.empty())
+    return 0.;
+  auto i = static_cast<size_t>(q * static_cast<double>(xs.size() - 1) + .5);
+  return static_cast<double>(xs[i]) / 1000.;
+}
+
+/// Writes the results of this node as a flat JSON object for the benchmark
+/// harness in `bench/`.
+void write_results(const std::string& path, const std::string& my_name,
+                   const cache& s, int64_t connect_ns,
+                   uint32_t connect_retries, int64_t share_ns,
+                   int64_t ready_ns) {
+  std::ofstream out{path};
+  if (!out) {
+    std::cerr << "Could not write results to " << path << std::endl;
+    return;
+  }
+  // Percentiles leave out the warm-up, unless it never ended.
+  auto warmup = s.rtt.warm() ? s.rtt.discarded() : size_t{0};
+  std::vector<int64_t> rtts(s.rtts.begin() + static_cast<ptrdiff_t>(warmup),
+                            s.rtts.end());
+  std::sort(rtts.begin(), rtts.end());
+  std::vector<int64_t> first;
+  for (auto& kvp : s.first_rtts)
+    first.push_back(kvp.second);
+  std::sort(first.begin(), first.end());
+  auto secs = static_cast<double>(s.measure_end - s.measure_begin) / 1e9;
+  int64_t active_ns = 0;
+  for (auto& kvp : s.round_spans)
+    active_ns += std::max(int64_t{0}, kvp.second.second - kvp.second.first);
+  auto active_secs = static_cast<double>(active_ns) / 1e9;
+  auto throughput = active_secs > 0.
+                    ? static_cast<double>(s.rtts.size()) / active_secs
+                    : 0.;
+  auto loss_rate = s.pings_sent > 0
+                   ? 1. - static_cast<double>(s.rtts.size())
+                            / static_cast<double>(s.pings_sent)
+                   : 0.;
+  out << "{" << std::endl
+      << "  \"name\": \"" << my_name << "\"," << std::endl
+      << "  \"connect_ms\": " << connect_ns / 1e6 << "," << std::endl
+      << "  \"connect_retries\": " << connect_retries << "," << std::endl
+      << "  \"share_ms\": " << share_ns / 1e6 << "," << std::endl
+      << "  \"ready_ms\": " << ready_ns / 1e6 << "," << std::endl
+      << "  \"pings_sent\": " << s.pings_sent << "," << std::endl
+      << "  \"pings_received\": " << s.pings_received << "," << std::endl
+      << "  \"pongs\": " << s.rtts.size() << "," << std::endl
+      << "  \"rounds\": " << s.rounds_measured << "," << std::endl
+      << "  \"warmup_samples\": " << warmup << "," << std::endl
+      << "  \"conclusive\": " << std::boolalpha << s.conclusive << ","
+      << std::endl
+      << "  \"first_rtt_p50_us\": " << percentile_us(first, .5) << ","
+      << std::endl
+      << "  \"first_rtt_max_us\": " << percentile_us(first, 1.) << ","
+      << std::endl
+      << "  \"rtt_mean_us\": " << s.rtt.samples().mean() << "," << std::endl
+      << "  \"rtt_ci95_us\": " << s.rtt.ci95() << "," << std::endl
+      << "  \"rtt_p50_us\": " << percentile_us(rtts, .5) << "," << std::endl
+      << "  \"rtt_p90_us\": " << percentile_us(rtts, .9) << "," << std::endl
+      << "  \"rtt_p99_us\": " << percentile_us(rtts, .99) << "," << std::endl
+      << "  \"loss_rate\": " << loss_rate << "," << std::endl
+      << "  \"measure_ms\": " << secs * 1e3 << "," << std::endl
+      << "  \"active_ms\": " << active_secs * 1e3 << "," << std::endl
+      << "  \"throughput_msgs_per_sec\": " << throughput << std::endl
+      << "}" << std::endl;
+}
+
+/// Remembers the RTT of the first exchange with `name`.
+void first_exchange(cache& s, const std::string& name, int64_t rtt) {
+  s.first_rtts.emplace(name, rtt);
+}
+
+double mean_us(const std::vector<int64_t>& xs) {
+  if (xs.empty())
+    return 0.;
+  double sum = 0.;
+  for (auto x : xs)
+    sum += static_cast<double>(x);
+  return sum / static_cast<double>(xs.size()) / 1000.;
+}
+
+/// Sends the ping of `round` to `name`. When pacing, the pong or a timeout
+/// frees its slot in the window of `name`. The timeout follows the RTTs
+/// measured to `name` and starts at 200ms.
+void send_ping(stateful_actor<cache>* self, const std::string& name,
+               int round, const std::string& my_name) {
+  auto& s = self->state;
+  self->send(s.others[name], ping_atom::value, round, clock_now(), my_name);
+  s.pings_sent += 1;
+  s.pings_to[name] += 1;
+  if (!s.pacing.enabled())
+    return;
+  s.outstanding[name].insert(round);
+  self->delayed_send(self, s.timeouts[name].timeout(), timeout_atom::value,
+                     name, round);
+}
+
+/// Sends what windows and pacer allow and wakes up again when the pacer
+/// permits the next ping.
+void pump(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  auto wait = s.pacing.pump();
+  if (wait == pacer::clock::duration::zero() || s.pump_scheduled)
+    return;
+  s.pump_scheduled = true;
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(wait);
+  self->delayed_send(self, std::max(us, std::chrono::microseconds(1)),
+                     pace_atom::value);
+}
+
+/// Stores all known nodes for the next start.
+void save_contacts(stateful_actor<cache>* self, const std::string& path) {
+  auto& s = self->state;
+  std::vector<peer_contact> xs;
+  for (auto& o : s.others) {
+    auto i = s.contacts.find(o.first);
+    if (i == s.contacts.end())
+      continue;
+    auto x = i->second;
+    x.node = to_string(o.second.node());
+    x.actor_id = o.second.id();
+    xs.push_back(std::move(x));
+  }
+  if (!save_peer_cache(path, xs))
+    std::cerr << "Could not write peer cache to " << path << std::endl;
+  else
+    aout(self) << "stored " << xs.size() << " contacts in " << path
+               << std::endl;
+}
+
 behavior ping_test(stateful_actor<cache>* self, const std::string& my_name,
-                   int rounds, actor main_actor) {
-  self->set_default_handler(skip);
+                   int rounds, int sync_rounds, double ci_target, bool prewarm,
+                   const std::string& results, actor main_actor,
+                   message_stash early, send_queue<std::string> pacing,
+                   stream_summary rtt, const std::string& peer_cache,
+                   uint32_t expected_peers, size_t cached_peers) {
+  self->state.port = 0;
+  self->state.connected = false;
+  self->state.cache_current = true;
+  self->state.share_pending = false;
+  self->state.pacing = pacing;
+  self->state.pump_scheduled = false;
+  self->state.pings_lost = 0;
+  self->state.pongs_late = 0;
+  self->state.pings_sent = 0;
+  self->state.rounds_measured = 0;
+  self->state.conclusive = false;
+  self->state.rtt = rtt;
+  self->state.pings_received = 0;
+  self->state.measure_begin = 0;
+  self->state.measure_end = 0;
+  self->state.early = early;
+  self->state.early.install(self);
+  // Reports the end of the share phase once. With a peer cache, knowing
+  // `expected_peers` nodes is enough, otherwise the own actor has to travel
+  // around the ring.
+  auto connected = [=] {
+    auto& s = self->state;
+    if (s.connected)
+      return;
+    s.connected = true;
+    self->send(main_actor, done_atom::value);
+  };
+  auto add_peer = [=](const actor& other, const std::string& name,
+                      const std::string& host, uint16_t port) {
+    auto& s = self->state;
+    s.others[name] = other;
+    s.contacts[name] = peer_contact{name, host, port, "", 0};
+    if (expected_peers > 0 && s.others.size() >= expected_peers)
+      connected();
+  };
+  // Sends the own actor around the ring unless the peer cache makes it
+  // redundant. Every cached node that still runs under its cached node and
+  // actor ID got a hello from this node, so if these cover all others, no
+  // node needs the ring share. A restarted or unreachable cached node means
+  // some contact went stale and the ring share goes out right away.
+  auto share = [=] {
+    auto& s = self->state;
+    if (!s.share_pending)
+      return;
+    auto cache_done = s.cache_resolved.size() >= cached_peers;
+    if (expected_peers > 0 && s.cache_current && !cache_done)
+      return;
+    s.share_pending = false;
+    if (expected_peers > 0 && s.cache_current
+        && s.others.size() >= expected_peers) {
+      aout(self) << "[r] all cached nodes current, skipped ring share"
+                 << std::endl;
+      return;
+    }
+    self->send(s.next, share_atom::value, self, my_name, s.host, s.port);
+  };
+  auto resolve_cached = [=](const std::string& name, bool current) {
+    auto& s = self->state;
+    if (!s.cache_resolved.insert(name).second)
+      return;
+    s.cache_current = s.cache_current && current;
+    share();
+  };
   return {
+    [=](contact_atom, const std::string& host, uint16_t port) {
+      self->state.host = host;
+      self->state.port = port;
+    },
+    [=](fail_atom) {
+      // The next node stayed unreachable. Only fatal if the ring share is
+      // still needed.
+      if (!self->state.connected)
+        self->send(main_actor, fail_atom::value);
+    },
     [=](actor next) {
       aout(self) << "[n] " << next.node().process_id() << std::endl;
-      self->state.next = next;
-      self->send(next, share_atom::value, self, my_name);
-      self->set_default_handler(print_and_drop);
-      self->become(
-        [=](share_atom, actor other, const std::string& name) {
-          auto& s = self->state;
-          if (other == self) {
-            aout(self) << "[r] actor returned" << std::endl;
-            self->send(main_actor, done_atom::value);
-          } else {
-            s.others[name] = other;
-            aout(self) << "[s] " << name << std::endl;
-            self->send(self->state.next, share_atom::value, other, name);
-          }
-        },
-        [=](measure_atom, int round) {
-          if (round > rounds) {
-            self->send(main_actor, done_atom::value);
-          } else {
-            for (auto& o : self->state.others)
-              self->send(o.second, ping_atom::value, round, my_name);
-            self->delayed_send(self, std::chrono::milliseconds(100),
-                               measure_atom::value, round + 1);
-          }
-        },
-        [=](ping_atom, int round, const std::string& name) {
-          aout(self) << "[i] " << name << std::endl;
-          return make_message(pong_atom::value, round, my_name);
-        },
-        [=](pong_atom, int round, const std::string& name) {
-          aout(self) << "[o] " << name << std::endl;
-          self->state.answers[name].insert(round);
-        },
-        [=](shutdown_atom) {
-          for (auto& o : self->state.others) {
-            std::set<int> missing;
-            for (int i = 0; i < rounds; ++i)
-              if (self->state.answers[o.first].count(i) == 0)
-                missing.insert(i);
-            aout(self) << o.first << " failed to answer to " << missing.size()
-                       << " pings" << std::endl;
-          }
-          aout(self) << "shutdown!" << std::endl;
-          self->quit();
-          self->send(main_actor, done_atom::value);
+      auto& s = self->state;
+      s.next = next;
+      for (auto& x : s.held_shares)
+        self->send(next, share_atom::value, x.first, x.second.name,
+                   x.second.host, x.second.port);
+      s.held_shares.clear();
+      s.share_pending = true;
+      share();
+      s.early.drain(self);
+    },
+    [=](share_atom, actor other, const std::string& name,
+        const std::string& host, uint16_t port) {
+      if (other == self) {
+        aout(self) << "[r] actor returned" << std::endl;
+        connected();
+      } else {
+        aout(self) << "[s] " << name << std::endl;
+        add_peer(other, name, host, port);
+        // Any message makes the middleman set up the direct connection
+        // in the background.
+        if (prewarm)
+          self->send(other, warm_atom::value);
+        auto& s = self->state;
+        if (s.next)
+          self->send(s.next, share_atom::value, other, name, host, port);
+        else
+          s.held_shares.emplace_back(other,
+                                     peer_contact{name, host, port, "", 0});
+      }
+    },
+    [=](restore_atom, actor other, const std::string& name,
+        const std::string& host, uint16_t port, bool current) {
+      // Reached a node from the peer cache, tell it about us as well.
+      aout(self) << "[p] " << name << (current ? "" : " (restarted)")
+                 << std::endl;
+      auto& s = self->state;
+      self->send(other, hello_atom::value, self, my_name, s.host, s.port);
+      add_peer(other, name, host, port);
+      resolve_cached(name, current);
+    },
+    [=](stale_atom, const std::string& name) {
+      // A cached node did not answer the first attempt.
+      aout(self) << "[x] " << name << std::endl;
+      resolve_cached(name, false);
+    },
+    [=](seed_atom, actor seed) {
+      // Reached a seed node, which does not know our name yet.
+      auto& s = self->state;
+      self->send(seed, seed_atom::value, self, my_name, s.host, s.port);
+    },
+    [=](seed_atom, actor other, const std::string& name,
+        const std::string& host, uint16_t port) {
+      aout(self) << "[e] " << name << std::endl;
+      auto& s = self->state;
+      self->send(other, hello_atom::value, self, my_name, s.host, s.port);
+      add_peer(other, name, host, port);
+    },
+    [=](hello_atom, actor other, const std::string& name,
+        const std::string& host, uint16_t port) {
+      aout(self) << "[h] " << name << std::endl;
+      add_peer(other, name, host, port);
+    },
+    [=](sync_atom, int round) {
+      if (round >= sync_rounds) {
+        for (auto& c : self->state.clocks)
+          aout(self) << "[c] " << c.first << " offset = "
+                     << c.second.offset() / 1000 << " +/- "
+                     << c.second.error() / 1000 << " us" << std::endl;
+        self->send(main_actor, done_atom::value);
+      } else {
+        for (auto& o : self->state.others)
+          self->send(o.second, sync_atom::value, clock_now(), my_name);
+        self->delayed_send(self, std::chrono::milliseconds(10),
+                           sync_atom::value, round + 1);
+      }
+    },
+    [=](sync_atom, int64_t t0, const std::string&) {
+      auto t1 = clock_now();
+      return make_message(sync_atom::value, t0, t1, clock_now(), my_name);
+    },
+    [=](sync_atom, int64_t t0, int64_t t1, int64_t t2,
+        const std::string& name) {
+      auto t3 = clock_now();
+      first_exchange(self->state, name, t3 - t0);
+      self->state.clocks[name].add(t0, t1, t2, t3);
+    },
+    [=](warm_atom) {
+      // nop
+    },
+    [=](measure_atom, int round) {
+      auto& s = self->state;
+      if (round == 0)
+        s.measure_begin = clock_now();
+      if (round > 0)
+        aout(self) << "[m] round " << round << ": " << s.rtt.discarded()
+                   << " warm-up, " << s.rtt.samples().count()
+                   << " samples, mean = " << s.rtt.samples().mean()
+                   << " +/- " << s.rtt.ci95() << " us, p50 = "
+                   << s.rtt.p50() << " us, p99 = " << s.rtt.p99() << " us"
+                   << std::endl;
+      s.conclusive = ci_target > 0. && s.rtt.conclusive(ci_target);
+      if (round > rounds || s.conclusive) {
+        s.rounds_measured = round;
+        self->send(main_actor, done_atom::value);
+      } else {
+        auto now = clock_now();
+        s.round_spans[round] = std::make_pair(now, now);
+        for (auto& o : s.others) {
+          auto name = o.first;
+          if (s.pacing.enabled())
+            s.pacing.push(name,
+                          [=] { send_ping(self, name, round, my_name); });
+          else
+            send_ping(self, name, round, my_name);
         }
-      );
+        pump(self);
+        self->delayed_send(self, std::chrono::milliseconds(100),
+                           measure_atom::value, round + 1);
+      }
+    },
+    [=](ping_atom, int round, int64_t t0, const std::string& name) {
+      auto t1 = clock_now();
+      aout(self) << "[i] " << name << std::endl;
+      self->state.pings_received += 1;
+      return make_message(pong_atom::value, round, t0, t1, clock_now(),
+                          my_name);
+    },
+    [=](pong_atom, int round, int64_t t0, int64_t t1, int64_t t2,
+        const std::string& name) {
+      auto t3 = clock_now();
+      aout(self) << "[o] " << name << std::endl;
+      auto& s = self->state;
+      if (s.outstanding[name].erase(round) > 0) {
+        s.pacing.window(name).acked();
+        pump(self);
+      } else if (s.overdue[name].erase(round) > 0) {
+        // The ping was not lost after all, only slower than the timeout.
+        s.pings_lost -= 1;
+        s.pongs_late += 1;
+      }
+      if (s.pacing.enabled())
+        s.timeouts[name].add(std::chrono::microseconds((t3 - t0) / 1000));
+      s.answers[name].insert(round);
+      first_exchange(s, name, t3 - t0);
+      s.rtts.push_back(t3 - t0);
+      auto span = s.round_spans.find(round);
+      if (span != s.round_spans.end())
+        span->second.second = std::max(span->second.second, t3);
+      s.rtt.add(static_cast<double>(t3 - t0) / 1000.);
+      s.measure_end = t3;
+      auto& c = s.clocks[name];
+      if (c.valid()) {
+        auto& l = s.latencies[name];
+        l.forward.push_back(c.forward_delay(t0, t1));
+        l.backward.push_back(c.return_delay(t2, t3));
+      }
+    },
+    [=](pace_atom) {
+      self->state.pump_scheduled = false;
+      pump(self);
+    },
+    [=](timeout_atom, const std::string& name, int round) {
+      auto& s = self->state;
+      if (s.outstanding[name].erase(round) == 0)
+        return;
+      auto& w = s.pacing.window(name);
+      w.timed_out();
+      w.release();
+      s.overdue[name].insert(round);
+      s.pings_lost += 1;
+      pump(self);
+    },
+    [=](shutdown_atom, int64_t connect_ns, uint32_t connect_retries,
+        int64_t share_ns, int64_t ready_ns) {
+      auto& s = self->state;
+      if (!results.empty())
+        write_results(results, my_name, s, connect_ns, connect_retries,
+                      share_ns, ready_ns);
+      if (!peer_cache.empty())
+        save_contacts(self, peer_cache);
+      for (auto& o : s.others) {
+        auto sent = s.pings_to[o.first];
+        auto missing = sent - std::min(sent, s.answers[o.first].size());
+        aout(self) << o.first << " failed to answer to " << missing
+                   << " of " << sent << " pings" << std::endl;
+        auto& l = self->state.latencies[o.first];
+        auto& c = self->state.clocks[o.first];
+        if (!l.forward.empty())
+          aout(self) << o.first << " one-way latency: forward = "
+                     << mean_us(l.forward) << " us, return = "
+                     << mean_us(l.backward) << " us (+/- "
+                     << c.error() / 1000. << " us)" << std::endl;
+      }
+      if (self->state.pacing.enabled())
+        aout(self) << self->state.pings_lost << " pings lost, "
+                   << self->state.pongs_late << " pongs late, "
+                   << self->state.pacing.queued() << " never sent"
+                   << std::endl;
+      aout(self) << "shutdown!" << std::endl;
+      self->quit();
+      self->send(main_actor, done_atom::value);
     }
   };
 }
@@ -144,6 +643,8 @@ struct net_stuff {
 };
 
 void caf_main(actor_system& system, const configuration& config) {
+  auto start = clock_now();
+  auto pin = placement::from(system, config);
   scoped_actor self{system};
   auto catch_up = [&]() {
     if (config.timeout > 0) {
@@ -172,7 +673,27 @@ void caf_main(actor_system& system, const configuration& config) {
             << std::endl
             << " > timeout = " << config.timeout << std::endl
             << " > rounds = " << config.rounds << std::endl
+            << " > ci-target = " << config.ci_target << " (batches of "
+            << config.stats_batch << ", warm-up tolerance "
+            << config.warmup_tolerance << ")" << std::endl
+            << " > sync-rounds = " << config.sync_rounds << std::endl
+            << " > results = " << config.results << std::endl
+            << " > perf-results = " << config.perf_results << std::endl
             << " > name = " << config.name << std::endl
+            << " > prewarm = " << (config.prewarm ? "y" : "n") << std::endl
+            << " > seeds = " << config.seeds << std::endl
+            << " > connect-deadline = " << config.connect_deadline
+            << "s (backoff " << config.backoff_initial << "-"
+            << config.backoff_max << "ms)" << std::endl
+            << " > peer-cache = " << config.peer_cache << " (advertise "
+            << config.advertise << ")" << std::endl
+            << " > window = " << config.window << " (max "
+            << config.max_window << ")" << std::endl
+            << " > pace-rate = " << config.pace_rate << "/s (burst "
+            << config.pace_burst << ")" << std::endl
+            << " > stash = " << config.stash_capacity << " ("
+            << config.stash_policy << ")" << std::endl
+            << " > placement = " << pin.to_string() << std::endl
             << " > id = " << system.node().process_id() << std::endl;;
   net_stuff ns(system, config);
   auto remote_port = config.port + config.offset;
@@ -181,7 +702,28 @@ void caf_main(actor_system& system, const configuration& config) {
                                   : config.name;
   if (config.local_port == 0)
     local_port = remote_port;
-  auto pt = system.spawn(ping_test, name, config.rounds, self);
+  message_stash early;
+  message_stash::policy stash_policy;
+  if (!message_stash::parse(config.stash_policy, stash_policy)) {
+    std::cerr << "Unknown stash policy: " << config.stash_policy << std::endl;
+    return;
+  }
+  early.configure(config.stash_capacity, stash_policy);
+  send_queue<std::string> pacing;
+  pacing.configure(config.window, config.max_window, config.pace_rate,
+                   config.pace_burst);
+  stream_summary rtt;
+  rtt.configure(config.stats_batch, config.warmup_tolerance);
+  // A node that finds contacts from a previous run connects to them directly
+  // and only needs the ring to discover nodes whose contact went stale.
+  std::vector<peer_contact> contacts;
+  auto warm = !config.peer_cache.empty()
+              && load_peer_cache(config.peer_cache, contacts)
+              && !contacts.empty();
+  auto pt = system.spawn(ping_test, name, config.rounds, config.sync_rounds,
+                         config.ci_target, config.prewarm, config.results,
+                         self, early, pacing, rtt, config.peer_cache,
+                         warm ? config.others : 0u, contacts.size());
   aout(self) << std::endl << "Opening local port ... " << std::endl;
   auto port = ns.publish(pt, local_port, nullptr, true);
   if (!port) {
@@ -190,31 +732,193 @@ void caf_main(actor_system& system, const configuration& config) {
     return;
   }
   aout(self) << "Published actor on " << *port << std::endl;
-  // Wait for user input. Make sure all participants published their actor.
-  catch_up();
-  auto next = ns.remote_actor(config.host, remote_port);
-  if (!next) {
-    std::cerr << "Could not connect to next node! (" << config.host << ":"
-              << remote_port << ")" << std::endl;
-    return;
+  self->send(pt, contact_atom::value, config.advertise, *port);
+  // A warm start skips the wait and relies on retries instead.
+  if (!warm) {
+    // Wait for user input. Make sure all participants published their actor.
+    catch_up();
+  }
+  // Neighbors may still be starting up, so all connection attempts retry
+  // with backoff until a common deadline instead of failing the run.
+  auto deadline = backoff::clock::now()
+                  + std::chrono::seconds(config.connect_deadline);
+  std::random_device seed_source;
+  // Set once the ring share finished or failed, so that threads still
+  // retrying stop instead of holding up the joins until the deadline.
+  std::atomic<bool> cancel{false};
+  auto connect_to = [&](const std::string& host, uint16_t to_port,
+                        backoff& b) {
+    return retry([&] { return ns.remote_actor(host, to_port); }, b, deadline,
+                 cancel);
+  };
+  auto make_backoff = [&] {
+    return backoff{std::chrono::milliseconds(config.backoff_initial),
+                   std::chrono::milliseconds(config.backoff_max),
+                   seed_source()};
+  };
+  perf_counters perf;
+  auto use_perf = !config.perf_results.empty();
+  auto begin_phase = [&](const char* phase) {
+    if (use_perf)
+      perf.start(phase);
+  };
+  auto end_phase = [&] {
+    if (use_perf)
+      perf.stop();
+  };
+  // The phase starts before the connect threads, so their counters inherit
+  // from the main thread, and ends after they have been joined.
+  begin_phase("connect");
+  std::atomic<uint32_t> reached{0};
+  std::atomic<uint32_t> restarted{0};
+  std::vector<std::thread> checks;
+  // Seed nodes give a second way into the cluster if the next node is slow.
+  std::istringstream seed_list{config.seeds};
+  std::string seed;
+  while (std::getline(seed_list, seed, ',')) {
+    auto sep = seed.rfind(':');
+    if (sep == std::string::npos) {
+      std::cerr << "Ignoring seed without port: " << seed << std::endl;
+      continue;
+    }
+    auto host = seed.substr(0, sep);
+    // No std::stoi here, an exception would end the process while earlier
+    // seed threads are still joinable.
+    auto digits = seed.substr(sep + 1);
+    char* end = nullptr;
+    auto value = std::strtol(digits.c_str(), &end, 10) + config.offset;
+    if (digits.empty() || *end != '\0' || value <= 0 || value > 65535) {
+      std::cerr << "Ignoring seed with invalid port: " << seed << std::endl;
+      continue;
+    }
+    auto seed_port = static_cast<uint16_t>(value);
+    checks.emplace_back([&, host, seed_port, b = make_backoff()]() mutable {
+      auto x = connect_to(host, seed_port, b);
+      if (x)
+        anon_send(pt, seed_atom::value, *x);
+      else if (!cancel)
+        std::cerr << "Could not reach seed " << host << ":" << seed_port
+                  << std::endl;
+    });
   }
-  aout(self) << "Connected." << std::endl << std::endl
-            << "Starting interaction ..." << std::endl;
-  self->send(pt, *next);
+  if (warm) {
+    aout(self) << "Connecting to " << contacts.size() << " cached nodes"
+               << std::endl;
+    for (auto& c : contacts)
+      checks.emplace_back([&, c, b = make_backoff()]() mutable {
+        // A cached node that is not up right away is stale for now, so the
+        // ring share need not wait for the retries. They stop once the node
+        // knows all others, so a node that left does not delay the restart.
+        auto x = ns.remote_actor(c.host, c.port);
+        if (!x) {
+          anon_send(pt, stale_atom::value, c.name);
+          x = connect_to(c.host, c.port, b);
+        }
+        if (!x)
+          return;
+        ++reached;
+        auto current = to_string(x->node()) == c.node
+                       && x->id() == c.actor_id;
+        if (!current)
+          ++restarted;
+        anon_send(pt, restore_atom::value, *x, c.name, c.host, c.port,
+                  current);
+      });
+  }
+  auto connect_begin = clock_now();
+  // The next node gets its own thread like seeds and cached nodes, so the
+  // test actor handles introductions, hellos and the ring shares of others
+  // while the next node is still starting. A warm start that reached all
+  // nodes through the cache does not wait for it at all.
+  int64_t connect_ns = 0;
+  uint32_t connect_retries = 0;
+  auto next_reached = false;
+  checks.emplace_back([&, b = make_backoff()]() mutable {
+    auto next = connect_to(config.host, static_cast<uint16_t>(remote_port),
+                           b);
+    connect_retries = b.attempts();
+    if (!next && cancel)
+      return;
+    if (!next) {
+      std::cerr << "Could not connect to next node! (" << config.host << ":"
+                << remote_port << ") after " << connect_retries
+                << " retries" << std::endl;
+      anon_send(pt, fail_atom::value);
+      return;
+    }
+    connect_ns = clock_now() - connect_begin;
+    next_reached = true;
+    anon_send(pt, *next);
+  });
+  aout(self) << "Starting interaction ..." << std::endl;
+  auto failed = false;
   self->receive(
     [&](done_atom) {
       aout(self) << "shared actor with all others" << std::endl;
+    },
+    [&](fail_atom) {
+      failed = true;
     }
   );
+  auto share_ns = clock_now() - connect_begin;
+  auto ready_ns = clock_now() - start;
+  cancel = true;
+  if (failed) {
+    for (auto& t : checks)
+      t.join();
+    end_phase();
+    self->send_exit(pt, exit_reason::user_shutdown);
+    return;
+  }
+  aout(self) << "full connectivity " << ready_ns / 1000000 << " ms after start"
+             << std::endl;
+  for (auto& t : checks)
+    t.join();
+  end_phase();
+  if (next_reached)
+    aout(self) << "connected to next node after " << connect_ns / 1000000
+               << " ms (" << connect_retries << " retries)" << std::endl;
+  else
+    aout(self) << "never reached the next node, the peer cache sufficed"
+               << std::endl;
+  if (warm) {
+    aout(self) << "peer cache: " << reached - restarted << " of "
+               << contacts.size() << " current, " << restarted
+               << " restarted, " << contacts.size() - reached
+               << " unreachable or given up" << std::endl;
+  }
   catch_up();
+  begin_phase("sync");
+  self->send(pt, sync_atom::value, 0);
+  self->receive(
+    [&](done_atom) {
+      aout(self) << "estimated clock offsets" << std::endl;
+    }
+  );
+  end_phase();
+  catch_up();
+  begin_phase("measure");
   self->send(pt, measure_atom::value, 0);
   self->receive(
     [&](done_atom) {
       aout(self) << "performed all measurements" << std::endl;
     }
   );
+  end_phase();
   catch_up();
-  self->send(pt, shutdown_atom::value);
+  begin_phase("shutdown");
+  self->send(pt, shutdown_atom::value, connect_ns, connect_retries, share_ns,
+             ready_ns);
+  self->receive(
+    [&](done_atom) {
+      aout(self) << "test actor quit" << std::endl;
+    }
+  );
+  end_phase();
+  if (use_perf) {
+    std::ofstream out{config.perf_results};
+    perf.write_json(out, name);
+  }
   catch_up();
   aout(self) << "bye" << std::endl;
 }
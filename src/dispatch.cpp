@@ -0,0 +1,128 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <caf/all.hpp>
+#include <caf/io/all.hpp>
+
+#include "protocol.hpp"
+
+using namespace caf;
+using namespace caf::io;
+
+namespace {
+
+using done_atom = caf::atom_constant<atom("done")>;
+
+// -----------------------------------------------------------------------------
+//  ACTOR SYSTEM CONFIG
+// -----------------------------------------------------------------------------
+
+class configuration : public actor_system_config {
+public:
+  uint32_t messages = 1000000;
+  configuration() {
+    load<io::middleman>();
+    add_protocol_types(*this);
+    opt_group{custom_options_,         "global"}
+      .add(messages,   "messages,m",   "number of messages per run");
+  }
+};
+
+struct counter {
+  uint32_t received = 0;
+};
+
+/// Counts a message and notifies `listener` after the last one.
+template <class Self>
+void handled(Self* self, uint32_t expected, const actor& listener) {
+  if (++self->state.received == expected)
+    self->send(listener, done_atom::value);
+}
+
+// Both actors implement the handlers of `ping_actor` in the same order as
+// `ping_test`, the dynamically typed one with the default handler it used.
+
+behavior dynamic_test(stateful_actor<counter>* self, uint32_t n,
+                      actor listener) {
+  self->set_default_handler(print_and_drop);
+  return {
+    [=](actor) { /* nop */ },
+    [=](digest_atom) { /* nop */ },
+    [=](sample_atom) { /* nop */ },
+    [=](timeout_atom, const actor&, uint32_t, int) { /* nop */ },
+    [=](const ack_msg&) { /* nop */ },
+    [=](const digest_msg&) { handled(self, n, listener); },
+    [=](const pull_msg&) { handled(self, n, listener); },
+    [=](const share_msg&) { handled(self, n, listener); },
+    [=](const ping_msg&) { handled(self, n, listener); },
+    [=](const pong_msg&) { handled(self, n, listener); },
+    [=](const done_msg&) { handled(self, n, listener); },
+    [=](const shutdown_msg&) { handled(self, n, listener); }
+  };
+}
+
+ping_actor::behavior_type
+typed_test(ping_actor::stateful_pointer<counter> self, uint32_t n,
+           actor listener) {
+  return {
+    [=](actor) { /* nop */ },
+    [=](digest_atom) { /* nop */ },
+    [=](sample_atom) { /* nop */ },
+    [=](timeout_atom, const actor&, uint32_t, int) { /* nop */ },
+    [=](const ack_msg&) { /* nop */ },
+    [=](const digest_msg&) { handled(self, n, listener); },
+    [=](const pull_msg&) { handled(self, n, listener); },
+    [=](const share_msg&) { handled(self, n, listener); },
+    [=](const ping_msg&) { handled(self, n, listener); },
+    [=](const pong_msg&) { handled(self, n, listener); },
+    [=](const done_msg&) { handled(self, n, listener); },
+    [=](const shutdown_msg&) { handled(self, n, listener); }
+  };
+}
+
+/// Sends `n` copies of `x` to `dest` and returns the average time per message
+/// until `dest` handled all of them.
+template <class Handle, class T>
+double ns_per_msg(scoped_actor& self, const Handle& dest, uint32_t n,
+                  const T& x) {
+  using namespace std::chrono;
+  auto t0 = steady_clock::now();
+  for (uint32_t i = 0; i < n; ++i)
+    anon_send(dest, x);
+  self->receive([](done_atom) { /* nop */ });
+  auto t1 = steady_clock::now();
+  anon_send_exit(dest, exit_reason::user_shutdown);
+  return duration_cast<nanoseconds>(t1 - t0).count() / double(n);
+}
+
+template <class T>
+void compare(actor_system& system, scoped_actor& self, const char* label,
+             uint32_t n, const T& x) {
+  auto dynamic_ns = ns_per_msg(self, system.spawn(dynamic_test, n, self), n,
+                               x);
+  auto typed_ns = ns_per_msg(self, system.spawn(typed_test, n, self), n, x);
+  std::cout << std::left << std::setw(10) << label << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(14) << dynamic_ns << std::setw(14) << typed_ns
+            << std::endl;
+}
+
+} // namespace anonymous
+
+void caf_main(actor_system& system, const configuration& config) {
+  scoped_actor self{system};
+  auto n = config.messages;
+  std::cout << "Handling cost per message, " << n << " messages per run"
+            << std::endl << std::endl
+            << std::left << std::setw(10) << "message" << std::right
+            << std::setw(14) << "dynamic [ns]" << std::setw(14) << "typed [ns]"
+            << std::endl;
+  // The first and the last handler of the protocol behavior plus the most
+  // frequent message type.
+  compare(system, self, "digest", n, digest_msg{0, 0});
+  compare(system, self, "pong", n, pong_msg{false, 0});
+  compare(system, self, "shutdown", n, shutdown_msg{0});
+}
+
+CAF_MAIN();
@@ -1,21 +1,29 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
 
 #include <caf/all.hpp>
 #include <caf/io/all.hpp>
 
+#include "ack_lane.hpp"
+#include "metrics.hpp"
+#include "placement.hpp"
+#include "protocol.hpp"
+#include "ring_protocol.hpp"
+#include "trace.hpp"
+
 using namespace caf;
 using namespace caf::io;
 
 namespace {
 
-using ack_atom = caf::atom_constant<atom("ack")>;
 using done_atom = caf::atom_constant<atom("done")>;
 using ping_atom = caf::atom_constant<atom("ping")>;
-using pong_atom = caf::atom_constant<atom("pong")>;
-using share_atom = caf::atom_constant<atom("share")>;
-using shutdown_atom = caf::atom_constant<atom("shutdown")>;
 
 // -----------------------------------------------------------------------------
 //  ACTOR SYSTEM CONFIG
@@ -25,218 +33,408 @@ class configuration : public actor_system_config {
 public:
   std::string host = "localhost";
   std::string name = "";
+  std::string trace = "";
   uint16_t port = 12345;
   uint16_t local_port = 0;
   uint16_t offset = 0;
+  uint16_t metrics_port = 0;
   uint32_t others = 7;
   uint32_t timeout = 0;
+  uint32_t fanout = 2;
+  uint32_t digest_delay = 5;
   int retransmits = 3;
+  placement pin;
   bool leader = false;
+  bool priority_lane = true;
   configuration() {
     load<io::middleman>();
+    add_protocol_types(*this);
     opt_group{custom_options_,         "global"}
       .add(port,       "port,P",       "set remote port")
       .add(local_port, "local-port,L", "set local port")
       .add(host,       "host,H",       "set host")
       .add(offset,     "offset,O",     "set offset for ports (for repeated local testing)")
-      .add(leader,     "leader,L",     "make this node the leader")
+      .add(leader,     "leader,L",     "make this node the root of the "
+                                       "termination tree")
       .add(timeout,    "timeout,t",    "use a timeout (sec) instead of user input")
       .add(name,       "name,n",       "name used for debugging")
       .add(retransmits,"retransmits,r","maxmimum number of retransmits")
+      .add(fanout,     "fanout,f",     "fan-out of the termination tree (0 = "
+                                       "all nodes report to the root)")
+      .add(digest_delay,"digest-delay,d","time (ms) to collect new actors "
+                                       "before sending a digest")
+      .add(metrics_port,"metrics-port", "serve metrics on localhost at this "
+                                       "port plus offset (0 = off)")
+      .add(trace,      "trace",        "record causally linked protocol events "
+                                       "to this file")
+      .add(priority_lane,"priority-lane","send acks, done and shutdown "
+                                       "messages with high priority and "
+                                       "serve them first")
       .add(others,     "others,o",     "set number of other nodes");
+    pin.add_options(custom_options_);
   }
 };
 
+// -----------------------------------------------------------------------------
+//  METRICS
+// -----------------------------------------------------------------------------
+
+/// Counters for one message kind, registered on first use. Updates from the
+/// actor are plain relaxed atomics, the exporter thread only reads them.
+struct kind_metrics {
+  metrics::value& sent;
+  metrics::value& received;
+  metrics::value& duplicates;
+
+  static kind_metrics& get(ring_kind x) {
+    static std::vector<kind_metrics> instances = make_all();
+    return instances[static_cast<size_t>(x)];
+  }
+
+  static std::vector<kind_metrics> make_all() {
+    auto& m = metrics::instance();
+    std::vector<kind_metrics> result;
+    for (size_t i = 0; i < static_cast<size_t>(ring_kind::num_kinds); ++i) {
+      auto labels = std::string{"type=\""}
+                    + to_string(static_cast<ring_kind>(i)) + "\"";
+      result.push_back(kind_metrics{
+        m.counter("autoconn_messages_sent_total",
+                  "Reliable messages sent, not counting retransmits.", labels),
+        m.counter("autoconn_messages_received_total",
+                  "Reliable messages received, including duplicates.",
+                  labels),
+        m.counter("autoconn_duplicates_dropped_total",
+                  "Received messages dropped as duplicates.", labels)
+      });
+    }
+    return result;
+  }
+};
+
+struct node_metrics {
+  metrics::value& retransmits;
+  metrics::value& failures;
+  metrics::value& in_flight;
+  metrics::value& connections;
+  metrics::value& mailbox;
+  histogram& rtt;
+
+  static node_metrics& get() {
+    auto& m = metrics::instance();
+    static node_metrics instance{
+      m.counter("autoconn_retransmits_total", "Retransmitted messages."),
+      m.counter("autoconn_retransmit_failures_total",
+                "Messages given up on after the maximum retransmits."),
+      m.gauge("autoconn_reliable_in_flight",
+              "Reliable messages waiting for an ack."),
+      m.gauge("autoconn_open_connections",
+              "Remote nodes this node received messages from."),
+      m.gauge("autoconn_mailbox_depth",
+              "Mailbox size of the protocol actor, sampled every 100ms."),
+      m.hist("autoconn_rtt_ms",
+             "Time from sending a message to its ack (first transmission "
+             "only).",
+             {1, 2, 5, 10, 20, 50, 100, 200, 500})
+    };
+    return instance;
+  }
+};
+
+// -----------------------------------------------------------------------------
+//  PROTOCOL ACTOR
+// -----------------------------------------------------------------------------
+
+/// Identifies an actor independent of the handle that refers to it.
+using actor_key = std::pair<node_id, actor_id>;
+
+struct cache;
+
+using self_pointer = ping_actor::stateful_pointer<cache>;
+
+/// Runs the ring protocol on CAF: messages travel as the structs of
+/// `protocol.hpp`, timers are delayed messages to the actor itself.
+struct ping_driver {
+  using peer = ping_actor;
+  using key = actor_key;
+  using message = ring_message<ping_actor>;
+
+  self_pointer self;
+
+  static actor_key key_of(const ping_actor& x) {
+    return {x.node(), x.id()};
+  }
+
+  void send(const ping_actor& to, const message& msg, int attempt);
+  void send_ack(const ping_actor& to, uint32_t seq);
+  void schedule_digest(std::chrono::milliseconds delay);
+  void schedule_retransmit(std::chrono::milliseconds delay,
+                           const ping_actor& to, uint32_t seq, int attempt);
+  void on_receive(const ping_actor& from, const message& msg, bool duplicate);
+  void on_ack(const ping_actor& to, const message& msg, int retransmits);
+  void on_give_up(const ping_actor& to, const message& msg);
+  void on_learn(const ping_actor& x);
+  void on_all_pongs();
+  void on_report(uint32_t total, size_t tree_size, bool is_root);
+  void on_in_flight(uint32_t n);
+  void on_quit();
+};
+
 struct cache {
-  actor next;
-  uint32_t received_pongs;
-  bool received_done;
-  std::unordered_map<actor, uint32_t> sending;
-  std::unordered_map<strong_actor_ptr, std::set<uint32_t>> receiving;
+  actor main_actor;
+  bool priority_lane;
+  std::unique_ptr<ring_protocol<ping_driver>> protocol;
+  /// Start of the first transmission of each unacknowledged message.
+  std::map<std::pair<actor_key, uint32_t>,
+           std::chrono::steady_clock::time_point> sent_at;
+  std::set<node_id> peers;
+  tracer trace;
+  /// Trace ID of the message currently handled, parent of all sends.
+  std::string current;
+  /// Trace ID of the message that scheduled the pending digest.
+  std::string digest_parent;
+  /// Trace IDs of the pongs and done messages `on_report` waits for.
+  std::vector<std::string> awaited;
 };
 
-template <class ... Ts>
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   const int max_retransmits, Ts ... xs) {
-  auto sequence_number = self->state.sending[dest]++;
-  auto msg = make_message(std::forward<Ts>(xs)..., sequence_number);
-  self->request(dest, std::chrono::milliseconds(200), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, 0, max_retransmits, msg);
+std::string trace_id(const node_id& from, const node_id& to, uint32_t seq) {
+  std::hash<node_id> h;
+  return tracer::id(h(from), h(to), seq);
+}
+
+/// Sends `x` to `to`, with high priority if `P` says so and the priority
+/// lane is on.
+template <message_priority P = message_priority::normal, class T>
+void transmit(self_pointer self, const ping_actor& to, T x, int attempt) {
+  if (attempt > 0)
+    std::cerr << "retransmitting: " << deep_to_string(x) << std::endl;
+  if (P == message_priority::high && self->state.priority_lane)
+    self->send<message_priority::high>(to, std::move(x));
+  else
+    self->send(to, std::move(x));
+}
+
+void ping_driver::send(const ping_actor& to, const message& msg,
+                       int attempt) {
+  auto& s = self->state;
+  std::string id;
+  if (s.trace.enabled())
+    id = trace_id(self->node(), to.node(), msg.seq);
+  if (attempt == 0) {
+    kind_metrics::get(msg.kind).sent.fetch_add(1, std::memory_order_relaxed);
+    s.sent_at[std::make_pair(key_of(to), msg.seq)] =
+      std::chrono::steady_clock::now();
+    if (!id.empty())
+      s.trace.send(id, s.current, to_string(msg.kind));
+  } else {
+    node_metrics::get().retransmits.fetch_add(1, std::memory_order_relaxed);
+    if (!id.empty())
+      s.trace.retransmit(id);
+  }
+  switch (msg.kind) {
+    case ring_kind::digest:
+      transmit(self, to, digest_msg{msg.value, msg.seq}, attempt);
+      break;
+    case ring_kind::pull:
+      transmit(self, to, pull_msg{msg.value, msg.seq}, attempt);
+      break;
+    case ring_kind::share: {
+      share_msg x;
+      for (auto& handle : msg.peers)
+        x.handles.push_back(actor_cast<actor>(handle));
+      x.seq = msg.seq;
+      transmit(self, to, std::move(x), attempt);
+      break;
     }
-  );
+    case ring_kind::ping:
+      transmit(self, to, ping_msg{msg.seq}, attempt);
+      break;
+    case ring_kind::pong:
+      transmit(self, to, pong_msg{msg.leader, msg.seq}, attempt);
+      break;
+    case ring_kind::done:
+      transmit<message_priority::high>(self, to,
+                                       done_msg{msg.value, msg.seq}, attempt);
+      break;
+    case ring_kind::shutdown:
+      transmit<message_priority::high>(self, to, shutdown_msg{msg.seq},
+                                       attempt);
+      break;
+    default:
+      break;
+  }
+}
+
+void ping_driver::send_ack(const ping_actor& to, uint32_t seq) {
+  ::send_ack(self, to, seq, self->state.priority_lane);
 }
 
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   int retransmit_count, const int max_retransmits,
-                   const caf::message& msg) {
-  if (retransmit_count >= max_retransmits) {
-    std::cerr << "ERROR: reached max retransmits!" << std::endl;
+void ping_driver::schedule_digest(std::chrono::milliseconds delay) {
+  self->state.digest_parent = self->state.current;
+  self->delayed_send(self, delay, digest_atom::value);
+}
+
+void ping_driver::schedule_retransmit(std::chrono::milliseconds delay,
+                                      const ping_actor& to, uint32_t seq,
+                                      int attempt) {
+  self->delayed_send(self, delay, timeout_atom::value, actor_cast<actor>(to),
+                     seq, attempt);
+}
+
+void ping_driver::on_receive(const ping_actor& from, const message& msg,
+                             bool duplicate) {
+  auto& s = self->state;
+  auto& nm = node_metrics::get();
+  auto& km = kind_metrics::get(msg.kind);
+  km.received.fetch_add(1, std::memory_order_relaxed);
+  if (s.peers.insert(from.node()).second)
+    nm.connections.store(s.peers.size(), std::memory_order_relaxed);
+  if (duplicate) {
+    std::cerr << "Ignoring duplicate" << std::endl;
+    km.duplicates.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (s.trace.enabled()) {
+    s.current = trace_id(from.node(), self->node(), msg.seq);
+    s.trace.receive(s.current, to_string(msg.kind), duplicate);
+    if (!duplicate
+        && (msg.kind == ring_kind::pong || msg.kind == ring_kind::done))
+      s.awaited.push_back(s.current);
+  }
+  if (duplicate)
     return;
+  switch (msg.kind) {
+    case ring_kind::ping:
+      std::cout << "[i] " << from.node().process_id() << std::endl;
+      break;
+    case ring_kind::pong:
+      std::cout << "[o] " << from.node().process_id() << std::endl;
+      break;
+    case ring_kind::done:
+      std::cout << "[d] " << msg.value << std::endl;
+      break;
+    default:
+      break;
   }
-  std::cerr << "retransmitting: " << to_string(msg) << std::endl;
-  self->request(dest, std::chrono::milliseconds(500), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, retransmit_count + 1, max_retransmits, msg);
+}
+
+void ping_driver::on_ack(const ping_actor& to, const message& msg,
+                         int retransmits) {
+  auto& s = self->state;
+  auto i = s.sent_at.find(std::make_pair(key_of(to), msg.seq));
+  if (i != s.sent_at.end()) {
+    // Acks of retransmits are ambiguous and do not count towards the RTT.
+    if (retransmits == 0) {
+      std::chrono::duration<double, std::milli> rtt =
+        std::chrono::steady_clock::now() - i->second;
+      node_metrics::get().rtt.observe(rtt.count());
     }
-  );
+    s.sent_at.erase(i);
+  }
+  if (s.trace.enabled())
+    s.trace.ack(trace_id(self->node(), to.node(), msg.seq));
 }
 
-bool is_duplicate(stateful_actor<cache>* self, uint32_t num) {
-  auto& nums = self->state.receiving[self->current_sender()];
-  auto res = nums.count(num) > 0;
-  nums.insert(num);
-  if (res)
-    std::cerr << "Ignoring duplicate" << std::endl;
-  return res;
+void ping_driver::on_give_up(const ping_actor& to, const message& msg) {
+  std::cerr << "ERROR: reached max retransmits!" << std::endl;
+  node_metrics::get().failures.fetch_add(1, std::memory_order_relaxed);
+  self->state.sent_at.erase(std::make_pair(key_of(to), msg.seq));
+}
+
+void ping_driver::on_learn(const ping_actor& x) {
+  std::cout << "[s] " << x.node().process_id() << std::endl;
+}
+
+void ping_driver::on_all_pongs() {
+  std::cout << "[O] got answers from all others" << std::endl;
+}
+
+void ping_driver::on_report(uint32_t total, size_t tree_size, bool is_root) {
+  auto& s = self->state;
+  if (s.trace.enabled())
+    s.trace.join(s.current, s.awaited);
+  if (is_root)
+    std::cout << "[D] " << total << " of " << tree_size << " nodes done"
+              << std::endl;
 }
 
-behavior ping_test(stateful_actor<cache>* self, uint32_t other_nodes,
-                   bool leader, const std::string& my_name,
-                   int max_retransmits, actor main_actor) {
-  self->state.received_pongs = 0;
-  self->set_default_handler(skip);
+void ping_driver::on_in_flight(uint32_t n) {
+  node_metrics::get().in_flight.store(n, std::memory_order_relaxed);
+}
+
+void ping_driver::on_quit() {
+  std::cout << "shutdown!" << std::endl;
+  self->state.trace.flush();
+  self->quit();
+  self->send(self->state.main_actor, done_atom::value);
+}
+
+/// Converts the current message to a `ring_message` and hands it to the
+/// protocol.
+void deliver(self_pointer self, ring_kind kind, uint32_t seq,
+             uint32_t value = 0, bool leader = false,
+             std::vector<ping_actor> peers = {}) {
+  auto from = actor_cast<ping_actor>(self->current_sender());
+  self->state.protocol->receive(
+    from, ring_message<ping_actor>{kind, seq, value, leader, std::move(peers)});
+}
+
+ping_actor::behavior_type
+ping_test(self_pointer self, ring_config cfg, bool priority_lane,
+          std::string trace_file, std::string name, actor main_actor) {
+  if (!self->state.trace.open(trace_file, std::hash<node_id>{}(self->node()),
+                              name))
+    std::cerr << "Could not write trace to " << trace_file << std::endl;
+  self->state.main_actor = main_actor;
+  self->state.priority_lane = priority_lane;
+  self->state.protocol.reset(new ring_protocol<ping_driver>{
+    ping_driver{self}, actor_cast<ping_actor>(self), cfg});
   return {
     [=](actor next) {
       std::cout << "[n] " << next.node().process_id() << std::endl;
-      self->state.next = next;
-      send_reliably(self, next, max_retransmits, share_atom::value,
-                    self, my_name);
-      self->set_default_handler(print_and_drop);
-      //self->become(
-        //[=](share_atom, actor an_actor, const std::string& name, uint32_t num) {
-          //if (!is_duplicate(self, num)) {
-            //auto&s = self->state;
-            //if (an_actor == self) {
-              //std::cout << "[r] actor returned" << std::endl;
-            //} else {
-              //std::cout << "[s] " << name << std::endl;
-              //send_reliably(self, s.next, max_retransmits, share_atom::value,
-                            //an_actor, name);
-              //send_reliably(self, an_actor, max_retransmits, ping_atom::value,
-                            //my_name);
-            //}
-          //}
-          //return ack_atom::value;
-        //},
-        //[=](ping_atom, const std::string& name, int32_t num) {
-          //if (!is_duplicate(self, num)) {
-            //std::cout << "[i] " << name << std::endl;
-            ////return caf::make_message(pong_atom::value, my_name);
-            //send_reliably(self, actor_cast<actor>(self->current_sender()),
-                          //max_retransmits, pong_atom::value, my_name);
-          //}
-          //return ack_atom::value;
-        //},
-        //[=](pong_atom, const std::string& name, int32_t num) {
-          //if (!is_duplicate(self, num)) {
-            //std::cout << "[o] " << name << std::endl;
-            //auto&s = self->state;
-            //s.received_pongs += 1;
-            //if (s.received_pongs >= other_nodes) {
-              //std::cout << "[O] got answers from all others" << std::endl;
-              //if (leader || s.received_done) {
-                //send_reliably(self, s.next, max_retransmits, done_atom::value,
-                              //name);
-              //}
-            //}
-          //}
-          //return ack_atom::value;
-        //},
-        //[=](done_atom, const std::string& name, int32_t num) {
-          //if (!is_duplicate(self, num)) {
-            //std::cout << "[d] " << name << std::endl;
-            //auto&s = self->state;
-            //s.received_done = true;
-            //if (leader) {
-              //send_reliably(self, s.next, max_retransmits, shutdown_atom::value,
-                            //name);
-            //} else if (s.received_pongs >= other_nodes) {
-              //send_reliably(self, s.next, max_retransmits, done_atom::value,
-                            //name);
-            //}
-          //}
-          //return ack_atom::value;
-        //},
-        //[=](shutdown_atom, const std::string& name, int32_t num) {
-          //if (!is_duplicate(self, num)) {
-            //std::cout << "shutdown!" << std::endl;
-            //if (!leader)
-              //send_reliably(self, self->state.next, max_retransmits,
-                            //shutdown_atom::value, name);
-            //self->quit();
-            //self->send(main_actor, done_atom::value);
-          //}
-          //return ack_atom::value;
-        //}
-      //);
+      self->state.current.clear();
+      self->state.protocol->connect(actor_cast<ping_actor>(next));
+    },
+    [=](sample_atom) {
+      // Counting the mailbox walks all of it, so only do it periodically.
+      node_metrics::get().mailbox.store(self->mailbox().count(),
+                                        std::memory_order_relaxed);
+      self->delayed_send(self, std::chrono::milliseconds(100),
+                         sample_atom::value);
+    },
+    [=](digest_atom) {
+      self->state.current = self->state.digest_parent;
+      self->state.protocol->digest_due();
+    },
+    [=](timeout_atom, const actor& to, uint32_t seq, int attempt) {
+      self->state.protocol->retransmit_due(actor_cast<ping_actor>(to), seq,
+                                           attempt);
     },
-    [=](share_atom, actor an_actor, const std::string& name, uint32_t num) {
-      if (!is_duplicate(self, num)) {
-        auto&s = self->state;
-        if (an_actor == self) {
-          std::cout << "[r] actor returned" << std::endl;
-        } else {
-          std::cout << "[s] " << name << std::endl;
-          send_reliably(self, s.next, max_retransmits, share_atom::value,
-                        an_actor, name);
-          send_reliably(self, an_actor, max_retransmits, ping_atom::value,
-                        my_name);
-        }
-      }
-      return ack_atom::value;
+    [=](const ack_msg& x) {
+      self->state.protocol->ack(actor_cast<ping_actor>(self->current_sender()),
+                                x.seq);
     },
-    [=](ping_atom, const std::string& name, uint32_t num) {
-      if (!is_duplicate(self, num)) {
-        std::cout << "[i] " << name << std::endl;
-        //return caf::make_message(pong_atom::value, my_name);
-        send_reliably(self, actor_cast<actor>(self->current_sender()),
-                      max_retransmits, pong_atom::value, my_name);
-      }
-      return ack_atom::value;
+    [=](const digest_msg& x) {
+      deliver(self, ring_kind::digest, x.seq, x.version);
     },
-    [=](pong_atom, const std::string& name, uint32_t num) {
-      if (!is_duplicate(self, num)) {
-        std::cout << "[o] " << name << std::endl;
-        auto&s = self->state;
-        s.received_pongs += 1;
-        if (s.received_pongs >= other_nodes) {
-          std::cout << "[O] got answers from all others" << std::endl;
-          if (leader || s.received_done) {
-            send_reliably(self, s.next, max_retransmits, done_atom::value,
-                          name);
-          }
-        }
-      }
-      return ack_atom::value;
+    [=](const pull_msg& x) {
+      deliver(self, ring_kind::pull, x.seq, x.from);
     },
-    [=](done_atom, const std::string& name, uint32_t num) {
-      if (!is_duplicate(self, num)) {
-        std::cout << "[d] " << name << std::endl;
-        auto&s = self->state;
-        s.received_done = true;
-        if (leader) {
-          send_reliably(self, s.next, max_retransmits, shutdown_atom::value,
-                        name);
-        } else if (s.received_pongs >= other_nodes) {
-          send_reliably(self, s.next, max_retransmits, done_atom::value,
-                        name);
-        }
-      }
-      return ack_atom::value;
+    [=](const share_msg& x) {
+      std::vector<ping_actor> peers;
+      for (auto& handle : x.handles)
+        peers.push_back(actor_cast<ping_actor>(handle));
+      deliver(self, ring_kind::share, x.seq, 0, false, std::move(peers));
     },
-    [=](shutdown_atom, const std::string& name, uint32_t num) {
-      if (!is_duplicate(self, num)) {
-        std::cout << "shutdown!" << std::endl;
-        if (!leader)
-          send_reliably(self, self->state.next, max_retransmits,
-                        shutdown_atom::value, name);
-        self->quit();
-        self->send(main_actor, done_atom::value);
-      }
-      return ack_atom::value;
+    [=](const ping_msg& x) {
+      deliver(self, ring_kind::ping, x.seq);
+    },
+    [=](const pong_msg& x) {
+      deliver(self, ring_kind::pong, x.seq, 0, x.leader);
+    },
+    [=](const done_msg& x) {
+      deliver(self, ring_kind::done, x.seq, x.completed);
+    },
+    [=](const shutdown_msg& x) {
+      deliver(self, ring_kind::shutdown, x.seq);
     }
   };
 }
@@ -251,12 +449,13 @@ struct net_stuff {
     // nop
   }
 
-  template <class ...Ts>
+  template <class Handle = actor, class ...Ts>
   auto remote_actor(Ts&&... args) {
+    auto& mm = sys.middleman();
     if (config.middleman_enable_udp)
-      return sys.middleman().remote_actor_udp(std::forward<Ts>(args)...);
+      return mm.template remote_actor_udp<Handle>(std::forward<Ts>(args)...);
     else
-      return sys.middleman().remote_actor(std::forward<Ts>(args)...);
+      return mm.template remote_actor<Handle>(std::forward<Ts>(args)...);
   }
 
   template <class ...Ts>
@@ -272,6 +471,7 @@ struct net_stuff {
 };
 
 void caf_main(actor_system& system, const configuration& config) {
+  auto pin = placement::from(system, config);
   std::cout << "Config: \n > host = " << config.host << std::endl
             << " > port = " << config.port << std::endl
             << " > local-port = " << config.local_port << std::endl
@@ -284,7 +484,14 @@ void caf_main(actor_system& system, const configuration& config) {
             << std::endl
             << " > timeout = " << config.timeout << std::endl
             << " > retransmits = " << config.retransmits << std::endl
-            << " > name = " << config.name << std::endl;
+            << " > fanout = " << config.fanout << std::endl
+            << " > digest-delay = " << config.digest_delay << std::endl
+            << " > metrics-port = " << config.metrics_port << std::endl
+            << " > trace = " << config.trace << std::endl
+            << " > priority-lane = " << std::boolalpha << config.priority_lane
+            << std::endl
+            << " > name = " << config.name << std::endl
+            << " > placement = " << pin.to_string() << std::endl;
   net_stuff ns(system, config);
   auto remote_port = config.port + config.offset;
   auto local_port = config.local_port + config.offset;
@@ -294,9 +501,33 @@ void caf_main(actor_system& system, const configuration& config) {
     local_port = remote_port;
   std::cout << "Node name = " << name << ", id = " << system.node().process_id()
             << std::endl;
+  metrics_server exporter;
+  auto metrics_port = config.metrics_port + config.offset;
+  if (config.metrics_port != 0 && metrics_port > 65535) {
+    std::cerr << "Metrics port " << config.metrics_port << " plus offset "
+              << config.offset << " is out of range" << std::endl;
+    return;
+  }
+  if (config.metrics_port != 0) {
+    metrics::instance().set_common_labels("node=\"" + name + "\"");
+    if (exporter.start(static_cast<uint16_t>(metrics_port)))
+      std::cout << "Serving metrics on localhost:" << metrics_port
+                << std::endl;
+    else
+      std::cerr << "Could not serve metrics on port " << metrics_port
+                << std::endl;
+  }
   scoped_actor self{system};
-  auto pt = system.spawn(ping_test, config.others, config.leader, name,
-                         config.retransmits, self);
+  ring_config cfg;
+  cfg.others = config.others;
+  cfg.fanout = config.fanout;
+  cfg.digest_delay = std::chrono::milliseconds(config.digest_delay);
+  cfg.max_retransmits = config.retransmits;
+  cfg.leader = config.leader;
+  auto pt = spawn_with_lane(system, config.priority_lane, ping_test, cfg,
+                            config.priority_lane, config.trace, name, self);
+  if (config.metrics_port != 0)
+    anon_send(pt, sample_atom::value);
   std::cout << std::endl << "Opening local port ... " << std::endl;
   auto port = ns.publish(pt, local_port, nullptr, true);
   if (!port) {
@@ -321,7 +552,7 @@ void caf_main(actor_system& system, const configuration& config) {
     std::cin.get();
     std::cout << std::endl << "Connecting to next node ..." << std::endl;
   }
-  auto next = ns.remote_actor(config.host, remote_port);
+  auto next = ns.remote_actor<ping_actor>(config.host, remote_port);
   if (!next) {
     std::cerr << "Could not connect to next node! (" << config.host << ":"
               << remote_port << ")" << std::endl;
@@ -329,7 +560,7 @@ void caf_main(actor_system& system, const configuration& config) {
   }
   std::cout << "Connected." << std::endl << std::endl
             << "Starting interaction ..." << std::endl;
-  self->send(pt, *next);
+  self->send(pt, actor_cast<actor>(*next));
   self->receive(
     [=](done_atom) {
       std::cout << "test actor quit" << std::endl;
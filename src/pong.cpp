@@ -1,22 +1,27 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <random>
 
 #include <caf/all.hpp>
 #include <caf/io/all.hpp>
 
+#include "ack_lane.hpp"
+#include "fec.hpp"
+#include "message_stash.hpp"
+#include "pacing.hpp"
+#include "placement.hpp"
+#include "protocol.hpp"
+
 using namespace caf;
 using namespace caf::io;
 
 namespace {
 
-using ack_atom = caf::atom_constant<atom("ack")>;
-using tag_atom = caf::atom_constant<atom("tag")>;
 using done_atom = caf::atom_constant<atom("done")>;
+using fec_atom = caf::atom_constant<atom("fec")>;
+using pace_atom = caf::atom_constant<atom("pace")>;
 using ping_atom = caf::atom_constant<atom("ping")>;
-using pong_atom = caf::atom_constant<atom("pong")>;
-using share_atom = caf::atom_constant<atom("share")>;
-using shutdown_atom = caf::atom_constant<atom("shutdown")>;
 
 // -----------------------------------------------------------------------------
 //  ACTOR SYSTEM CONFIG
@@ -26,15 +31,28 @@ class configuration : public actor_system_config {
 public:
   std::string host = "localhost";
   std::string name = "";
+  std::string stash_policy = "backpressure";
   uint16_t port = 12345;
   uint16_t local_port = 0;
   uint16_t offset = 0;
   uint32_t others = 7;
   uint32_t timeout = 0;
   int retransmits = 3;
+  placement pin;
+  uint32_t stash_capacity = 1024;
+  uint32_t fec_group = 0;
+  uint32_t fec_delay = 10;
+  uint32_t window = 0;
+  uint32_t max_window = 64;
+  uint32_t pace_rate = 0;
+  uint32_t pace_burst = 16;
+  uint32_t drop_seed = 0;
+  double drop_rate = 0.;
   bool leader = false;
+  bool priority_lane = true;
   configuration() {
     load<io::middleman>();
+    add_protocol_types(*this);
     opt_group{custom_options_,         "global"}
       .add(port,       "port,P",       "set remote port")
       .add(local_port, "local-port,L", "set local port")
@@ -46,151 +64,410 @@ public:
                                        "input")
       .add(name,       "name,n",       "name used for debugging")
       .add(retransmits,"retransmits,r","maxmimum number of retransmits")
+      .add(stash_capacity,"stash-capacity","maximum number of messages kept "
+                                       "before the ring is wired")
+      .add(stash_policy,"stash-policy","what to do with early messages when "
+                                       "the stash is full (drop, nack, "
+                                       "backpressure)")
+      .add(priority_lane,"priority-lane","send acks, tags and shutdowns with "
+                                       "high priority and serve them first")
+      .add(fec_group,  "fec-group",    "send an XOR parity after this many "
+                                       "reliable messages to a node (0 = off)")
+      .add(fec_delay,  "fec-delay",    "time (ms) after which an incomplete "
+                                       "group gets its parity")
+      .add(drop_rate,  "drop-rate",    "drop this fraction of outgoing "
+                                       "messages, parities and acks to "
+                                       "emulate a lossy network")
+      .add(drop_seed,  "drop-seed",    "seed for --drop-rate (plus the local "
+                                       "port)")
+      .add(window,     "window",       "initial congestion window per node "
+                                       "(0 = unlimited)")
+      .add(max_window, "max-window",   "maximum congestion window per node")
+      .add(pace_rate,  "pace-rate",    "maximum reliable messages per second "
+                                       "to all nodes (0 = unlimited)")
+      .add(pace_burst, "pace-burst",   "messages that may leave at once when "
+                                       "pacing")
       .add(others,     "others,o",     "set number of other nodes");
+    pin.add_options(custom_options_);
   }
 };
 
+/// A reliable message waiting for its ack.
+struct outgoing {
+  message msg;
+  message_priority priority;
+  int retransmits;
+};
+
+/// Parity of the group currently sent to one node.
+struct fec_group_state {
+  fec_encoder parity;
+  uint32_t first;
+};
+
 struct cache {
+  message_stash early;
+  send_queue<actor> pacing;
+  bool pump_scheduled;
   actor next;
+  actor main_actor;
   std::vector<actor> others;
   uint32_t received_pongs;
-  bool received_done;
+  uint32_t in_flight;
   bool tagged;
   bool done;
+  bool shutting_down;
+  bool priority_lane;
+  uint32_t retransmits;
+  uint32_t spurious;
+  uint32_t failures;
+  uint32_t duplicates;
+  uint32_t recovered;
+  uint32_t fec_group;
+  std::chrono::milliseconds fec_delay;
+  std::unordered_map<actor, fec_group_state> fec_out;
+  std::unordered_map<strong_actor_ptr, fec_decoder> fec_in;
   std::unordered_map<actor, uint32_t> sending;
+  std::unordered_map<actor, std::map<uint32_t, outgoing>> unacked;
   std::unordered_map<strong_actor_ptr, std::set<uint32_t>> receiving;
+  double drop_rate;
+  std::minstd_rand drop_gen;
+  uint32_t dropped;
+  std::chrono::steady_clock::time_point started;
 };
 
-template <class ... Ts>
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   const int max_retransmits, Ts ... xs) {
-  auto sequence_number = self->state.sending[dest]++;
-  auto msg = make_message(std::forward<Ts>(xs)..., sequence_number);
-  self->request(dest, std::chrono::milliseconds(200), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, 0, max_retransmits, msg);
-    }
-  );
+void quit_now(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - s.started;
+  std::cout << "[r] retransmits = " << s.retransmits << ", spurious = "
+            << s.spurious << ", given up = " << s.failures
+            << ", duplicates = " << s.duplicates << ", recovered = "
+            << s.recovered << ", dropped = " << s.dropped << std::endl;
+  std::cout << "[T] finished after " << elapsed.count() << " ms"
+            << std::endl;
+  std::cout << "shutdown!" << std::endl;
+  self->quit();
+  self->send(self->state.main_actor, done_atom::value);
+}
+
+/// Called whenever a reliable message is either acknowledged or given up on.
+void settle(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  s.in_flight -= 1;
+  if (s.shutting_down && s.in_flight == 0)
+    quit_now(self);
 }
 
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   int retransmit_count, const int max_retransmits,
-                   const caf::message& msg) {
-  if (retransmit_count >= max_retransmits) {
-    std::cerr << "ERROR: reached max retransmits!" << std::endl;
+/// Emulates a lossy network for `--drop-rate`: returns `true` if the next
+/// message to `dest` should disappear. Messages to this actor always arrive.
+bool lose(stateful_actor<cache>* self, const actor& dest) {
+  auto& s = self->state;
+  if (s.drop_rate <= 0. || dest == self
+      || !std::bernoulli_distribution{s.drop_rate}(s.drop_gen))
+    return false;
+  s.dropped += 1;
+  return true;
+}
+
+std::vector<char> serialize(stateful_actor<cache>* self, message msg) {
+  std::vector<char> buf;
+  binary_serializer sink{self->system(), buf};
+  if (sink(msg))
+    buf.clear();
+  return buf;
+}
+
+/// Sends the parity of the current group to `dest`. Parity messages are not
+/// acknowledged, losing one only costs the chance to recover.
+void fec_flush(stateful_actor<cache>* self, const actor& dest) {
+  auto& out = self->state.fec_out[dest];
+  auto count = out.parity.count();
+  if (count == 0)
     return;
+  auto bytes = out.parity.take();
+  if (!lose(self, dest))
+    self->send(dest, parity_msg{out.first, count, std::move(bytes)});
+}
+
+/// Adds the first transmission of message `seq` to the parity for `dest`.
+/// The group ends after `fec_group` messages or `fec_delay`, whichever comes
+/// first, so that a sparse stream does not wait for its parity forever.
+void fec_add(stateful_actor<cache>* self, const actor& dest, uint32_t seq,
+             const message& msg) {
+  auto& s = self->state;
+  auto& out = s.fec_out[dest];
+  if (out.parity.count() == 0) {
+    out.first = seq;
+    self->delayed_send(self, s.fec_delay, fec_atom::value, dest, seq);
   }
-  std::cerr << "retransmitting: " << to_string(msg) << std::endl;
-  self->request(dest, std::chrono::milliseconds(500), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, retransmit_count + 1, max_retransmits, msg);
-    }
-  );
+  out.parity.add(serialize(self, msg));
+  if (out.parity.count() >= s.fec_group)
+    fec_flush(self, dest);
+}
+
+/// Sends `x` and schedules a timeout for this attempt. The first attempt
+/// waits 200ms for the ack, retransmits wait 500ms.
+void transmit(stateful_actor<cache>* self, const actor& dest, uint32_t seq,
+              const outgoing& x) {
+  // The timeout below also covers messages lost on purpose.
+  if (lose(self, dest))
+    std::cerr << "dropping: " << to_string(x.msg) << std::endl;
+  else if (x.priority == message_priority::high)
+    self->send<message_priority::high>(dest, x.msg);
+  else
+    self->send(dest, x.msg);
+  auto timeout = std::chrono::milliseconds(x.retransmits == 0 ? 200 : 500);
+  self->delayed_send(self, timeout, timeout_atom::value, dest, seq,
+                     x.retransmits);
+}
+
+/// Sends the first attempt of message `seq` to `dest`.
+void first_transmit(stateful_actor<cache>* self, const actor& dest,
+                    uint32_t seq) {
+  auto& s = self->state;
+  auto& x = s.unacked[dest][seq];
+  transmit(self, dest, seq, x);
+  if (s.fec_group > 0 && dest != self)
+    fec_add(self, dest, seq, x.msg);
+}
+
+/// Sends what windows and pacer allow and wakes up again when the pacer
+/// permits the next message.
+void pump(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  auto wait = s.pacing.pump();
+  if (wait == pacer::clock::duration::zero() || s.pump_scheduled)
+    return;
+  s.pump_scheduled = true;
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(wait);
+  self->delayed_send(self, std::max(us, std::chrono::microseconds(1)),
+                     pace_atom::value);
+}
+
+/// Sends `x` with the next sequence number to `dest` until it sends an ack.
+/// Acks are separate messages instead of responses to a request, because a
+/// response inherits the priority of the request and acks for bulk traffic
+/// must not wait behind it.
+template <message_priority P = message_priority::normal, class T>
+void send_reliably(stateful_actor<cache>* self, const actor dest, T msg) {
+  auto& s = self->state;
+  auto seq = s.sending[dest]++;
+  auto priority = s.priority_lane ? P : message_priority::normal;
+  msg.seq = seq;
+  auto& x = s.unacked[dest][seq];
+  x = outgoing{make_message(std::move(msg)), priority, 0};
+  s.in_flight += 1;
+  if (!s.pacing.enabled() || dest == self) {
+    first_transmit(self, dest, seq);
+    return;
+  }
+  s.pacing.push(dest, [=] { first_transmit(self, dest, seq); });
+  pump(self);
+}
+
+/// Acknowledges message `num` of the current sender, on the high-priority
+/// lane if enabled.
+void ack(stateful_actor<cache>* self, uint32_t num) {
+  auto dest = actor_cast<actor>(self->current_sender());
+  if (!lose(self, dest))
+    send_ack(self, dest, num, self->state.priority_lane);
 }
 
 bool is_duplicate(stateful_actor<cache>* self, uint32_t num) {
   auto& nums = self->state.receiving[self->current_sender()];
   auto res = nums.count(num) > 0;
   nums.insert(num);
-  if (res)
+  if (res) {
     std::cerr << "Ignoring duplicate" << std::endl;
+    self->state.duplicates += 1;
+  } else if (self->state.fec_group > 0) {
+    self->state.fec_in[self->current_sender()].add(
+      num, serialize(self, self->current_message()));
+  }
   return res;
 }
 
+/// Returns the process ID of the sender of the current message for logging.
+uint32_t sender_id(stateful_actor<cache>* self) {
+  return self->current_sender()->node().process_id();
+}
+
 behavior ping_test(stateful_actor<cache>* self, uint32_t other_nodes,
-                   bool leader, const std::string& my_name,
-                   int max_retransmits, actor main_actor) {
+                   bool leader, int max_retransmits, bool priority_lane,
+                   uint32_t fec_group, uint32_t fec_delay, double drop_rate,
+                   uint32_t drop_seed, actor main_actor, message_stash early,
+                   send_queue<actor> pacing) {
+  self->state.main_actor = main_actor;
   self->state.received_pongs = 0;
+  self->state.in_flight = 0;
   self->state.tagged = false;
   self->state.done = false;
-  self->set_default_handler(skip);
+  self->state.shutting_down = false;
+  self->state.priority_lane = priority_lane;
+  self->state.retransmits = 0;
+  self->state.spurious = 0;
+  self->state.failures = 0;
+  self->state.duplicates = 0;
+  self->state.recovered = 0;
+  self->state.fec_group = fec_group;
+  self->state.fec_delay = std::chrono::milliseconds(fec_delay);
+  self->state.drop_rate = drop_rate;
+  self->state.drop_gen.seed(drop_seed);
+  self->state.dropped = 0;
+  self->state.early = early;
+  self->state.early.install(self);
+  self->state.pacing = pacing;
+  self->state.pump_scheduled = false;
   return {
     [=](actor next) {
       std::cout << "[n] " << next.node().process_id() << std::endl;
       self->state.next = next;
+      self->state.started = std::chrono::steady_clock::now();
       if (leader)
-        send_reliably(self, self, max_retransmits, tag_atom::value);
-      self->set_default_handler(print_and_drop);
+        send_reliably<message_priority::high>(self, self, tag_msg{0});
+      self->state.early.drain(self);
       self->become(
-        [=](tag_atom, uint32_t num) {
-          if (self->current_sender() == self || !is_duplicate(self, num)) {
+        [=](const ack_msg& x) {
+          auto& s = self->state;
+          auto dest = actor_cast<actor>(self->current_sender());
+          auto& pending = s.unacked[dest];
+          auto i = pending.find(x.seq);
+          if (i == pending.end()) {
+            // An earlier attempt already got its ack.
+            s.spurious += 1;
+            return;
+          }
+          pending.erase(i);
+          if (s.pacing.enabled() && dest != self) {
+            s.pacing.window(dest).acked();
+            pump(self);
+          }
+          settle(self);
+        },
+        [=](pace_atom) {
+          self->state.pump_scheduled = false;
+          pump(self);
+        },
+        [=](timeout_atom, const actor& dest, uint32_t num, int attempt) {
+          auto& s = self->state;
+          auto& pending = s.unacked[dest];
+          auto i = pending.find(num);
+          if (i == pending.end() || i->second.retransmits != attempt)
+            return;
+          auto paced = s.pacing.enabled() && dest != self;
+          if (attempt >= max_retransmits) {
+            std::cerr << "ERROR: reached max retransmits!" << std::endl;
+            s.failures += 1;
+            pending.erase(i);
+            if (paced) {
+              s.pacing.window(dest).release();
+              pump(self);
+            }
+            settle(self);
+            return;
+          }
+          if (paced)
+            s.pacing.window(dest).timed_out();
+          std::cerr << "retransmitting: " << to_string(i->second.msg)
+                    << std::endl;
+          s.retransmits += 1;
+          i->second.retransmits += 1;
+          transmit(self, dest, num, i->second);
+        },
+        [=](fec_atom, const actor& dest, uint32_t first) {
+          auto& out = self->state.fec_out[dest];
+          if (out.parity.count() > 0 && out.first == first)
+            fec_flush(self, dest);
+        },
+        [=](const parity_msg& x) {
+          auto& s = self->state;
+          auto& sender = self->current_sender();
+          uint32_t num;
+          std::vector<char> buf;
+          if (!s.fec_in[sender].recover(x.first, x.count, x.bytes, num, buf)
+              || s.receiving[sender].count(num) > 0)
+            return;
+          message msg;
+          binary_deserializer source{self->system(), buf};
+          if (source(msg))
+            return;
+          std::cout << "[f] recovered message " << num << std::endl;
+          s.recovered += 1;
+          // Handle the rebuilt message as if it came from the sender.
+          self->enqueue(make_mailbox_element(sender, message_id::make(), {},
+                                             std::move(msg)),
+                        self->context());
+        },
+        [=](const tag_msg& x) {
+          if (self->current_sender() == self || !is_duplicate(self, x.seq)) {
             std::cout << "[t] I'm it! " << std::endl;
             auto& s = self->state;
             if (s.done) {
-              send_reliably(self, s.next, max_retransmits, done_atom::value,
-                            my_name);
+              // The tag made a full round since we sent our pings, i.e.,
+              // every node received all its pongs. Use the mesh to tell
+              // everyone at once instead of walking the ring twice.
+              for (auto a : s.others)
+                send_reliably<message_priority::high>(self, a,
+                                                      shutdown_msg{0});
+              s.shutting_down = true;
+              if (s.in_flight == 0)
+                quit_now(self);
             } else if (s.tagged) {
               for (auto a : s.others)
-                send_reliably(self, a, max_retransmits, ping_atom::value,
-                              my_name);
+                send_reliably(self, a, ping_msg{0});
               s.done = true;
             } else {
-              send_reliably(self, s.next, max_retransmits, share_atom::value,
-                            self, my_name);
+              send_reliably(self, s.next,
+                            share_msg{{actor_cast<actor>(self)}, 0});
               s.tagged = true;
             }
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](share_atom, actor an_actor, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
+        [=](const share_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
             auto& s = self->state;
-            if (an_actor == self) {
-              std::cout << "[r] actor returned" << std::endl;
-              send_reliably(self, s.next, max_retransmits, tag_atom::value);
-            } else {
-              s.others.push_back(an_actor);
-              std::cout << "[s] " << name << std::endl;
-              send_reliably(self, s.next, max_retransmits, share_atom::value,
-                            an_actor, name);
+            for (auto& an_actor : x.handles) {
+              if (an_actor == self) {
+                std::cout << "[r] actor returned" << std::endl;
+                send_reliably<message_priority::high>(self, s.next,
+                                                      tag_msg{0});
+              } else {
+                s.others.push_back(an_actor);
+                std::cout << "[s] " << an_actor.node().process_id()
+                          << std::endl;
+                send_reliably(self, s.next, share_msg{{an_actor}, 0});
+              }
             }
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](ping_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "[i] " << name << std::endl;
+        [=](const ping_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[i] " << sender_id(self) << std::endl;
             send_reliably(self, actor_cast<actor>(self->current_sender()),
-                          max_retransmits, pong_atom::value, my_name);
+                          pong_msg{leader, 0});
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](pong_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "[o] " << name << std::endl;
+        [=](const pong_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[o] " << sender_id(self) << std::endl;
             auto& s = self->state;
             s.received_pongs += 1;
             if (s.received_pongs >= other_nodes)
-              send_reliably(self, s.next, max_retransmits, tag_atom::value);
-          }
-          return ack_atom::value;
-        },
-        [=](done_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "[d] " << name << std::endl;
-            auto&s = self->state;
-            s.received_done = true;
-            if (leader)
-              send_reliably(self, s.next, max_retransmits, shutdown_atom::value,
-                            name);
-            else
-              send_reliably(self, s.next, max_retransmits, done_atom::value,
-                            name);
+              send_reliably<message_priority::high>(self, s.next,
+                                                    tag_msg{0});
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](shutdown_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "shutdown!" << std::endl;
-            if (!leader)
-              send_reliably(self, self->state.next, max_retransmits,
-                            shutdown_atom::value, name);
-            self->quit();
-            self->send(main_actor, done_atom::value);
+        [=](const shutdown_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[x] " << sender_id(self) << std::endl;
+            quit_now(self);
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         }
       );
     }
@@ -228,6 +505,7 @@ struct net_stuff {
 };
 
 void caf_main(actor_system& system, const configuration& config) {
+  auto pin = placement::from(system, config);
   std::cout << "Config: \n > host = " << config.host << std::endl
             << " > port = " << config.port << std::endl
             << " > local-port = " << config.local_port << std::endl
@@ -240,7 +518,20 @@ void caf_main(actor_system& system, const configuration& config) {
             << std::endl
             << " > timeout = " << config.timeout << std::endl
             << " > retransmit_count = " << config.retransmits << std::endl
-            << " > name = " << config.name << std::endl;
+            << " > name = " << config.name << std::endl
+            << " > stash = " << config.stash_capacity << " ("
+            << config.stash_policy << ")" << std::endl
+            << " > priority-lane = " << std::boolalpha
+            << config.priority_lane << std::endl
+            << " > fec-group = " << config.fec_group << " ("
+            << config.fec_delay << "ms)" << std::endl
+            << " > drop-rate = " << config.drop_rate << " (seed "
+            << config.drop_seed << ")" << std::endl
+            << " > window = " << config.window << " (max "
+            << config.max_window << ")" << std::endl
+            << " > pace-rate = " << config.pace_rate << "/s (burst "
+            << config.pace_burst << ")" << std::endl
+            << " > placement = " << pin.to_string() << std::endl;
   net_stuff ns(system, config);
   auto remote_port = config.port + config.offset;
   auto local_port = config.local_port + config.offset;
@@ -248,11 +539,25 @@ void caf_main(actor_system& system, const configuration& config) {
                                   : config.name;
   if (config.local_port == 0)
     local_port = remote_port;
+  message_stash early;
+  message_stash::policy stash_policy;
+  if (!message_stash::parse(config.stash_policy, stash_policy)) {
+    std::cerr << "Unknown stash policy: " << config.stash_policy << std::endl;
+    return;
+  }
+  early.configure(config.stash_capacity, stash_policy);
+  send_queue<actor> pacing;
+  pacing.configure(config.window, config.max_window, config.pace_rate,
+                   config.pace_burst);
   std::cout << "Node name = " << name << ", id = " << system.node().process_id()
             << std::endl;
   scoped_actor self{system};
-  auto pt = system.spawn(ping_test, config.others, config.leader, name,
-                         config.retransmits, self);
+  auto pt = spawn_with_lane(system, config.priority_lane, ping_test,
+                            config.others, config.leader, config.retransmits,
+                            config.priority_lane, config.fec_group,
+                            config.fec_delay, config.drop_rate,
+                            config.drop_seed + local_port, self, early,
+                            pacing);
   std::cout << std::endl << "Opening local port ... " << std::endl;
   auto port = ns.publish(pt, local_port, nullptr, true);
   if (!port) {
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <caf/all.hpp>
+#include <caf/io/all.hpp>
+
+#include "protocol.hpp"
+
+using namespace caf;
+using namespace caf::io;
+
+namespace {
+
+using ack_atom = caf::atom_constant<atom("ack")>;
+using done_atom = caf::atom_constant<atom("done")>;
+using ping_atom = caf::atom_constant<atom("ping")>;
+using pong_atom = caf::atom_constant<atom("pong")>;
+using share_atom = caf::atom_constant<atom("share")>;
+using shutdown_atom = caf::atom_constant<atom("shutdown")>;
+
+// -----------------------------------------------------------------------------
+//  ACTOR SYSTEM CONFIG
+// -----------------------------------------------------------------------------
+
+class configuration : public actor_system_config {
+public:
+  uint32_t iterations = 100000;
+  std::string name = "mercury";
+  configuration() {
+    load<io::middleman>();
+    add_protocol_types(*this);
+    opt_group{custom_options_,         "global"}
+      .add(iterations, "iterations,i", "number of encode/decode runs per "
+                                       "message")
+      .add(name,       "name,n",       "name used in the tuple messages");
+  }
+};
+
+struct result {
+  size_t bytes;
+  double encode_ns;
+  double decode_ns;
+};
+
+/// Serializes and deserializes `msg` `n` times and reports the average cost
+/// per operation as well as the size on the wire.
+result measure(actor_system& sys, const message& msg, uint32_t n) {
+  using namespace std::chrono;
+  result res;
+  std::vector<char> buf;
+  auto t0 = steady_clock::now();
+  for (uint32_t i = 0; i < n; ++i) {
+    buf.clear();
+    binary_serializer sink{sys, buf};
+    auto copy = msg;
+    auto err = sink(copy);
+    if (err) {
+      std::cerr << "failed to serialize " << to_string(msg) << std::endl;
+      return {0, 0., 0.};
+    }
+  }
+  auto t1 = steady_clock::now();
+  for (uint32_t i = 0; i < n; ++i) {
+    binary_deserializer source{sys, buf};
+    message x;
+    auto err = source(x);
+    if (err) {
+      std::cerr << "failed to deserialize " << to_string(msg) << std::endl;
+      return {0, 0., 0.};
+    }
+  }
+  auto t2 = steady_clock::now();
+  res.bytes = buf.size();
+  res.encode_ns = duration_cast<nanoseconds>(t1 - t0).count() / double(n);
+  res.decode_ns = duration_cast<nanoseconds>(t2 - t1).count() / double(n);
+  return res;
+}
+
+void compare(actor_system& sys, const std::string& label, const message& tuple,
+             const message& compact, uint32_t n) {
+  auto x = measure(sys, tuple, n);
+  auto y = measure(sys, compact, n);
+  std::cout << std::left << std::setw(10) << label << std::right
+            << std::fixed << std::setprecision(1)
+            << std::setw(8) << x.bytes << std::setw(8) << y.bytes
+            << std::setw(12) << x.encode_ns << std::setw(12) << y.encode_ns
+            << std::setw(12) << x.decode_ns << std::setw(12) << y.decode_ns
+            << std::endl;
+}
+
+} // namespace anonymous
+
+void caf_main(actor_system& system, const configuration& config) {
+  auto n = config.iterations;
+  auto& name = config.name;
+  uint32_t seq = 42;
+  auto handle = system.spawn([] {
+    // nop
+  });
+  std::cout << "Comparing tuples (t) with protocol structs (s), "
+            << n << " iterations" << std::endl << std::endl
+            << std::left << std::setw(10) << "message" << std::right
+            << std::setw(8) << "t [B]" << std::setw(8) << "s [B]"
+            << std::setw(12) << "t enc [ns]" << std::setw(12) << "s enc [ns]"
+            << std::setw(12) << "t dec [ns]" << std::setw(12) << "s dec [ns]"
+            << std::endl;
+  compare(system, "share",
+          make_message(share_atom::value, handle, name, seq),
+          make_message(share_msg{{handle}, seq}), n);
+  compare(system, "ping",
+          make_message(ping_atom::value, name, seq),
+          make_message(ping_msg{seq}), n);
+  compare(system, "pong",
+          make_message(pong_atom::value, name, seq),
+          make_message(pong_msg{false, seq}), n);
+  compare(system, "done",
+          make_message(done_atom::value, name, seq),
+          make_message(done_msg{1, seq}), n);
+  compare(system, "shutdown",
+          make_message(shutdown_atom::value, name, seq),
+          make_message(shutdown_msg{seq}), n);
+  compare(system, "ack",
+          make_message(ack_atom::value),
+          make_message(ack_msg{seq}), n);
+}
+
+CAF_MAIN();
@@ -1,22 +1,22 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <map>
 
 #include <caf/all.hpp>
 #include <caf/io/all.hpp>
 
+#include "ack_lane.hpp"
+#include "message_stash.hpp"
+#include "placement.hpp"
+#include "protocol.hpp"
+
 using namespace caf;
 using namespace caf::io;
 
 namespace {
 
-using ack_atom = caf::atom_constant<atom("ack")>;
-using done_atom = caf::atom_constant<atom("done")>;
 using ping_atom = caf::atom_constant<atom("ping")>;
-using pong_atom = caf::atom_constant<atom("pong")>;
-using peer_atom = caf::atom_constant<atom("peer")>;
-using share_atom = caf::atom_constant<atom("share")>;
-using shutdown_atom = caf::atom_constant<atom("shutdown")>;
 
 // -----------------------------------------------------------------------------
 //  ACTOR SYSTEM CONFIG
@@ -26,15 +26,21 @@ class configuration : public actor_system_config {
 public:
   std::string host = "localhost";
   std::string name = "";
+  std::string stash_policy = "backpressure";
   uint16_t port = 12345;
   uint16_t local_port = 0;
   uint16_t offset = 0;
   uint32_t others = 7;
   uint32_t timeout = 0;
+  uint32_t group_size = 0;
   int retransmits = 3;
+  placement pin;
+  uint32_t stash_capacity = 1024;
   bool leader = false;
+  bool priority_lane = true;
   configuration() {
     load<io::middleman>();
+    add_protocol_types(*this);
     opt_group{custom_options_,         "global"}
       .add(port,       "port,P",       "set remote port")
       .add(local_port, "local-port,L", "set local port")
@@ -44,46 +50,91 @@ public:
       .add(timeout,    "timeout,t",    "use a timeout (sec) instead of user input")
       .add(name,       "name,n",       "name used for debugging")
       .add(retransmits,"retransmits,r","maxmimum number of retransmits")
+      .add(group_size, "group-size,g", "number of nodes per sub-leader (0 = flat star)")
+      .add(stash_capacity,"stash-capacity","maximum number of messages kept "
+                                       "before the ring is wired")
+      .add(stash_policy,"stash-policy","what to do with early messages when "
+                                       "the stash is full (drop, nack, "
+                                       "backpressure)")
+      .add(priority_lane,"priority-lane","send acks, done and shutdown "
+                                       "messages with high priority and "
+                                       "serve them first")
       .add(others,     "others,o",     "set number of other nodes");
+    pin.add_options(custom_options_);
   }
 };
 
+/// A reliable message waiting for its ack.
+struct outgoing {
+  message msg;
+  message_priority priority;
+  int retransmits;
+};
+
 struct cache {
+  message_stash early;
   actor leader;
   actor next;
+  actor coordinator;
+  std::vector<actor> peers;
   uint32_t received_pongs;
-  bool received_done;
+  uint32_t position;
+  uint32_t group_members;
+  uint32_t completed;
+  uint32_t in_flight;
+  size_t max_mailbox;
+  bool sub_leader;
+  bool reported;
+  bool shutting_down;
+  bool priority_lane;
+  std::chrono::steady_clock::time_point started;
   std::unordered_map<actor, uint32_t> sending;
+  std::unordered_map<actor, std::map<uint32_t, outgoing>> unacked;
   std::unordered_map<strong_actor_ptr, std::set<uint32_t>> receiving;
 };
 
-template <class ... Ts>
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   int max_retransmits, Ts ... xs) {
-  auto sequence_number = self->state.sending[dest]++;
-  auto msg = make_message(std::forward<Ts>(xs)..., sequence_number);
-  self->request(dest, std::chrono::milliseconds(200), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, 0, max_retransmits, msg);
-    }
-  );
+/// Called whenever a reliable message is either acknowledged or given up on.
+void settle(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  s.in_flight -= 1;
+  if (s.shutting_down && s.in_flight == 0) {
+    std::cout << "shutdown!" << std::endl;
+    self->quit();
+  }
 }
 
-void send_reliably(stateful_actor<cache>* self, const actor dest,
-                   int retransmit_count, int max_retransmits,
-                   const caf::message& msg) {
-  if (retransmit_count >= max_retransmits) {
-    std::cerr << "ERROR: reached max retransmits!" << std::endl;
-    return;
-  }
-  std::cerr << "retransmitting: " << to_string(msg) << std::endl;
-  self->request(dest, std::chrono::milliseconds(500), msg).then(
-    [=](ack_atom) { /* nop */ },
-    [=](const error&) {
-      send_reliably(self, dest, retransmit_count + 1, max_retransmits, msg);
-    }
-  );
+/// Sends `x` and schedules a timeout for this attempt. The first attempt
+/// waits 200ms for the ack, retransmits wait 500ms.
+void transmit(stateful_actor<cache>* self, const actor& dest, uint32_t seq,
+              const outgoing& x) {
+  if (x.priority == message_priority::high)
+    self->send<message_priority::high>(dest, x.msg);
+  else
+    self->send(dest, x.msg);
+  auto timeout = std::chrono::milliseconds(x.retransmits == 0 ? 200 : 500);
+  self->delayed_send(self, timeout, timeout_atom::value, dest, seq,
+                     x.retransmits);
+}
+
+/// Sends `x` with the next sequence number to `dest` until it sends an ack.
+/// Acks are separate messages, see `ack_lane.hpp`. With the priority lane,
+/// `P` applies to all attempts.
+template <message_priority P = message_priority::normal, class T>
+void send_reliably(stateful_actor<cache>* self, const actor dest, T x) {
+  auto& s = self->state;
+  auto seq = s.sending[dest]++;
+  auto priority = s.priority_lane ? P : message_priority::normal;
+  x.seq = seq;
+  auto& out = s.unacked[dest][seq];
+  out = outgoing{make_message(std::move(x)), priority, 0};
+  s.in_flight += 1;
+  transmit(self, dest, seq, out);
+}
+
+/// Acknowledges message `num` of the current sender.
+void ack(stateful_actor<cache>* self, uint32_t num) {
+  send_ack(self, actor_cast<actor>(self->current_sender()), num,
+           self->state.priority_lane);
 }
 
 bool is_duplicate(stateful_actor<cache>* self, uint32_t num) {
@@ -95,90 +146,207 @@ bool is_duplicate(stateful_actor<cache>* self, uint32_t num) {
   return res;
 }
 
+/// Returns the process ID of the sender of the current message for logging.
+uint32_t sender_id(stateful_actor<cache>* self) {
+  return self->current_sender()->node().process_id();
+}
+
+/// Tracks the largest mailbox seen by a coordinator (root or sub-leader).
+/// Counting the mailbox walks all of it, so a timer calls this every 10ms
+/// instead of every message.
+void sample_mailbox(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  s.max_mailbox = std::max(s.max_mailbox, self->mailbox().count());
+  if (!s.shutting_down)
+    self->delayed_send(self, std::chrono::milliseconds(10),
+                       sample_atom::value);
+}
+
+/// Returns the milliseconds since this node started coordinating its peers.
+long long elapsed_ms(stateful_actor<cache>* self) {
+  using namespace std::chrono;
+  auto d = steady_clock::now() - self->state.started;
+  return duration_cast<milliseconds>(d).count();
+}
+
+void report_coordination(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  std::cout << "[m] " << s.peers.size() << " direct peers, mailbox "
+            << "high-water mark = " << s.max_mailbox << std::endl;
+}
+
+/// Sends `shutdown` to all direct peers and quits once they acknowledged it.
+void broadcast_shutdown(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  if (!s.peers.empty())
+    report_coordination(self);
+  for (auto& peer : s.peers)
+    send_reliably<message_priority::high>(self, peer, shutdown_msg{0});
+  s.shutting_down = true;
+  if (s.peers.empty() || s.in_flight == 0) {
+    std::cout << "shutdown!" << std::endl;
+    self->quit();
+  }
+}
+
+/// Called by a sub-leader whenever a member of its group completes.
+void report_group(stateful_actor<cache>* self) {
+  auto& s = self->state;
+  if (s.reported || s.completed < s.group_members)
+    return;
+  s.reported = true;
+  std::cout << "[G] group of " << s.completed << " done after "
+            << elapsed_ms(self) << " ms" << std::endl;
+  send_reliably<message_priority::high>(self, s.leader,
+                                        done_msg{s.completed, 0});
+}
+
+/// Runs the star scenario. With `group_size > 0`, every `group_size`-th node
+/// along the ring becomes a sub-leader that collects the peers of its group
+/// and forwards an aggregated completion count to the leader. This bounds
+/// the fan-in at the leader to the number of groups.
 behavior ping_test(stateful_actor<cache>* self, uint32_t other_nodes,
-                   bool leader, const std::string& my_name,
-                   int max_retransmits) {
+                   bool leader, uint32_t group_size, int max_retransmits,
+                   bool priority_lane, message_stash early) {
   self->state.received_pongs = 0;
-  self->set_default_handler(skip);
+  self->state.completed = 0;
+  self->state.group_members = 0;
+  self->state.in_flight = 0;
+  self->state.max_mailbox = 0;
+  self->state.sub_leader = false;
+  self->state.reported = false;
+  self->state.shutting_down = false;
+  self->state.priority_lane = priority_lane;
+  self->state.early = early;
+  self->state.early.install(self);
   return {
     [=](actor next) {
       std::cout << "[n] " << next.node().process_id() << std::endl;
       self->state.next = next;
-      if (leader)
-        send_reliably(self, next, max_retransmits, share_atom::value,
-                      self, my_name);
-      self->set_default_handler(print_and_drop);
+      if (leader) {
+        self->state.started = std::chrono::steady_clock::now();
+        self->send(self, sample_atom::value);
+        auto me = actor_cast<actor>(self);
+        send_reliably(self, next, announce_msg{me, me, 1, 0});
+      }
+      self->state.early.drain(self);
       self->become(
-        [=](share_atom, actor leader, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            // TODO: Save leader actor and only forward it on received ping
-            //       from leader!!!
+        [=](sample_atom) {
+          sample_mailbox(self);
+        },
+        [=](const ack_msg& x) {
+          auto& s = self->state;
+          auto& pending = s.unacked[actor_cast<actor>(self->current_sender())];
+          // Ignore acks for attempts after the first acknowledged one.
+          if (pending.erase(x.seq) > 0)
+            settle(self);
+        },
+        [=](timeout_atom, const actor& dest, uint32_t num, int attempt) {
+          auto& pending = self->state.unacked[dest];
+          auto i = pending.find(num);
+          if (i == pending.end() || i->second.retransmits != attempt)
+            return;
+          if (attempt >= max_retransmits) {
+            std::cerr << "ERROR: reached max retransmits!" << std::endl;
+            pending.erase(i);
+            settle(self);
+            return;
+          }
+          std::cerr << "retransmitting: " << to_string(i->second.msg)
+                    << std::endl;
+          i->second.retransmits += 1;
+          transmit(self, dest, num, i->second);
+        },
+        [=](const announce_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
             auto& s = self->state;
-            if (leader == self) {
+            if (x.leader == self) {
               std::cout << "[r] actor returned" << std::endl;
             } else {
-              std::cout << "[s] " << name << std::endl;
-              s.leader = leader;
-              //send_reliably(self, s.next, max_retransmits, share_atom::value,
-                            //an_actor, name);
-              send_reliably(self, leader, max_retransmits, peer_atom::value,
-                            self, my_name);
+              auto position = x.position;
+              std::cout << "[s] " << sender_id(self) << " @ " << position
+                        << std::endl;
+              s.leader = x.leader;
+              s.position = position;
+              s.coordinator = x.coordinator;
+              if (group_size > 0 && (position - 1) % group_size == 0) {
+                // First node of a group: coordinate the rest of the group.
+                // The last group may be cut short by the end of the ring.
+                s.sub_leader = true;
+                s.coordinator = x.leader;
+                s.started = std::chrono::steady_clock::now();
+                s.group_members = std::min(group_size,
+                                           other_nodes - (position - 1)) - 1;
+                std::cout << "[S] sub-leader for " << s.group_members
+                          << " peers" << std::endl;
+                self->send(self, sample_atom::value);
+              }
+              send_reliably(self, s.coordinator, peer_msg{0});
             }
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](peer_atom, actor peer, std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "[p] " << name << std::endl;
-            send_reliably(self, peer, max_retransmits, ping_atom::value,
-                          self, my_name);
+        [=](const peer_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[p] " << sender_id(self) << std::endl;
+            auto peer = actor_cast<actor>(self->current_sender());
+            self->state.peers.push_back(peer);
+            send_reliably(self, peer, ping_msg{0});
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](ping_atom, actor sender, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "[i] " << name << std::endl;
-            send_reliably(self, sender, max_retransmits, pong_atom::value,
-                          my_name);
-            send_reliably(self, self->state.next, max_retransmits,
-                          share_atom::value, self->state.leader, name);
+        [=](const ping_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[i] " << sender_id(self) << std::endl;
+            auto& s = self->state;
+            send_reliably(self, actor_cast<actor>(self->current_sender()),
+                          pong_msg{false, 0});
+            auto group_lead = s.sub_leader ? actor_cast<actor>(self)
+                                           : s.coordinator;
+            send_reliably(self, s.next,
+                          announce_msg{s.leader, group_lead, s.position + 1,
+                                       0});
+            if (s.sub_leader)
+              report_group(self);
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](pong_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
+        [=](const pong_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            auto name = sender_id(self);
             std::cout << "[o] " << name << std::endl;
             auto& s = self->state;
+            std::cout << "[c] " << name << " completed after "
+                      << elapsed_ms(self) << " ms" << std::endl;
             s.received_pongs += 1;
-            if (leader && s.received_pongs >= other_nodes)
-              send_reliably(self, s.next, max_retransmits, done_atom::value,
-                            my_name);
+            s.completed += 1;
+            if (s.sub_leader)
+              report_group(self);
+            else if (leader && s.completed >= other_nodes)
+              broadcast_shutdown(self);
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](done_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
+        [=](const done_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            auto name = sender_id(self);
             std::cout << "[d] " << name << std::endl;
-            auto&s = self->state;
-            s.received_done = true;
-            if (leader)
-              send_reliably(self, s.next, max_retransmits, shutdown_atom::value,
-                            name);
-            else
-              send_reliably(self, s.next, max_retransmits, done_atom::value,
-                            name);
+            auto& s = self->state;
+            std::cout << "[c] group of " << name << " (" << x.completed
+                      << " peers) completed after " << elapsed_ms(self)
+                      << " ms" << std::endl;
+            s.completed += x.completed;
+            if (leader && s.completed >= other_nodes)
+              broadcast_shutdown(self);
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         },
-        [=](shutdown_atom, const std::string& name, uint32_t num) {
-          if (!is_duplicate(self, num)) {
-            std::cout << "shutdown!" << std::endl;
-            if (!leader)
-              send_reliably(self, self->state.next, max_retransmits,
-                            shutdown_atom::value, name);
-            self->quit();
+        [=](const shutdown_msg& x) {
+          if (!is_duplicate(self, x.seq)) {
+            std::cout << "[x] " << sender_id(self) << std::endl;
+            broadcast_shutdown(self);
           }
-          return ack_atom::value;
+          ack(self, x.seq);
         }
       );
     }
@@ -214,6 +382,7 @@ struct protocol_dispatch {
 };
 
 void caf_main(actor_system& system, const configuration& config) {
+  auto pin = placement::from(system, config);
   std::cout << "Config: \n > host = " << config.host << std::endl
             << " > port = " << config.port << std::endl
             << " > local-port = " << config.local_port << std::endl
@@ -226,7 +395,13 @@ void caf_main(actor_system& system, const configuration& config) {
             << std::endl
             << " > timeout = " << config.timeout << std::endl
             << " > retransmit_count = " << config.retransmits << std::endl
-            << " > name = " << config.name << std::endl;
+            << " > group-size = " << config.group_size << std::endl
+            << " > name = " << config.name << std::endl
+            << " > stash = " << config.stash_capacity << " ("
+            << config.stash_policy << ")" << std::endl
+            << " > priority-lane = " << std::boolalpha << config.priority_lane
+            << std::endl
+            << " > placement = " << pin.to_string() << std::endl;
   protocol_dispatch pd(system, config);
   auto remote_port = config.port + config.offset;
   auto local_port = config.local_port + config.offset;
@@ -234,11 +409,19 @@ void caf_main(actor_system& system, const configuration& config) {
                                   : config.name;
   if (config.local_port == 0)
     local_port = remote_port;
+  message_stash early;
+  message_stash::policy stash_policy;
+  if (!message_stash::parse(config.stash_policy, stash_policy)) {
+    std::cerr << "Unknown stash policy: " << config.stash_policy << std::endl;
+    return;
+  }
+  early.configure(config.stash_capacity, stash_policy);
   std::cout << "Node name = " << name << ", id = " << system.node().process_id()
             << std::endl;
   scoped_actor self{system};
-  auto pt = system.spawn(ping_test, config.others, config.leader, name,
-                        config.retransmits);
+  auto pt = spawn_with_lane(system, config.priority_lane, ping_test,
+                            config.others, config.leader, config.group_size,
+                            config.retransmits, config.priority_lane, early);
   std::cout << std::endl << "Opening local port ... " << std::endl;
   auto port = pd.publish(pt, local_port, nullptr, true);
   if (!port) {
@@ -0,0 +1,124 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+#include <caf/all.hpp>
+
+#include "simulator.hpp"
+
+using namespace caf;
+
+namespace {
+
+// -----------------------------------------------------------------------------
+//  ACTOR SYSTEM CONFIG
+// -----------------------------------------------------------------------------
+
+class configuration : public actor_system_config {
+public:
+  uint32_t nodes = 8;
+  uint32_t fanout = 2;
+  uint32_t digest_delay = 5;
+  uint32_t seed = 0;
+  uint32_t deadline = 3600;
+  uint32_t fec_group = 0;
+  uint32_t fec_delay = 10;
+  int retransmits = 3;
+  double latency = 0.5;
+  double jitter = 0.1;
+  double loss = 0.;
+  double cpu = 5.;
+  bool ordered = false;
+  configuration() {
+    opt_group{custom_options_,         "global"}
+      .add(nodes,      "nodes,N",      "number of simulated nodes")
+      .add(fanout,     "fanout,f",     "fan-out of the termination tree (0 = "
+                                       "all nodes report to the root)")
+      .add(digest_delay,"digest-delay,d","time (ms) to collect new actors "
+                                       "before sending a digest")
+      .add(retransmits,"retransmits,r","maxmimum number of retransmits")
+      .add(latency,    "latency",      "minimum one-way delay (ms)")
+      .add(jitter,     "jitter",       "mean additional one-way delay (ms), "
+                                       "exponentially distributed")
+      .add(loss,       "loss",         "probability of losing a datagram")
+      .add(ordered,    "ordered",      "deliver datagrams between two nodes "
+                                       "in the order they were sent")
+      .add(cpu,        "cpu",          "time (us) to handle one message")
+      .add(fec_group,  "fec-group",    "send an XOR parity after this many "
+                                       "reliable messages to a node (0 = off)")
+      .add(fec_delay,  "fec-delay",    "time (ms) after which an incomplete "
+                                       "group gets its parity")
+      .add(seed,       "seed,s",       "seed of the network model")
+      .add(deadline,   "deadline",     "stop after this much virtual time (s)");
+  }
+};
+
+double ms(sim_time x) {
+  return static_cast<double>(x) / sim_ms;
+}
+
+} // namespace anonymous
+
+void caf_main(actor_system&, const configuration& config) {
+  network_model net;
+  net.latency_ms = config.latency;
+  net.jitter_ms = config.jitter;
+  net.loss = config.loss;
+  net.cpu_us = config.cpu;
+  net.ordered = config.ordered;
+  std::cout << "Config: \n > nodes = " << config.nodes << std::endl
+            << " > fanout = " << config.fanout << std::endl
+            << " > digest-delay = " << config.digest_delay << std::endl
+            << " > retransmits = " << config.retransmits << std::endl
+            << " > latency = " << config.latency << std::endl
+            << " > jitter = " << config.jitter << std::endl
+            << " > loss = " << config.loss << std::endl
+            << " > ordered = " << std::boolalpha << config.ordered
+            << std::endl
+            << " > cpu = " << config.cpu << std::endl
+            << " > fec-group = " << config.fec_group << " ("
+            << config.fec_delay << "ms)" << std::endl
+            << " > seed = " << config.seed << std::endl;
+  ring_config cfg;
+  cfg.fanout = config.fanout;
+  cfg.digest_delay = std::chrono::milliseconds(config.digest_delay);
+  cfg.max_retransmits = config.retransmits;
+  ring_simulation sim{config.nodes, cfg, net, config.seed};
+  if (config.fec_group > 0)
+    sim.enable_fec(config.fec_group, config.fec_delay * sim_ms);
+  auto t0 = std::chrono::steady_clock::now();
+  auto stats = sim.run(static_cast<sim_time>(config.deadline) * 1000 * sim_ms);
+  auto t1 = std::chrono::steady_clock::now();
+  std::chrono::duration<double> wall = t1 - t0;
+  std::cout << std::endl
+            << std::left << std::setw(10) << "message" << std::right
+            << std::setw(12) << "sent" << std::setw(12) << "retransmit"
+            << std::setw(12) << "lost" << std::setw(12) << "duplicate"
+            << std::endl;
+  for (size_t i = 0; i < sim_stats::num_kinds; ++i)
+    std::cout << std::left << std::setw(10)
+              << to_string(static_cast<sim_kind>(i)) << std::right
+              << std::setw(12) << stats.sent[i]
+              << std::setw(12) << stats.retransmits[i]
+              << std::setw(12) << stats.lost[i]
+              << std::setw(12) << stats.duplicates[i] << std::endl;
+  std::cout << std::endl << std::fixed << std::setprecision(3)
+            << "given up: " << stats.failures << std::endl
+            << "sent to a quit node: " << stats.dropped << std::endl
+            << "recovered from parity: " << stats.recovered << std::endl
+            << "nodes done: " << stats.nodes_done << " of " << config.nodes
+            << std::endl
+            << "nodes quit: " << stats.nodes_quit << " of " << config.nodes
+            << std::endl
+            << "all pongs after: " << ms(stats.all_pongs) << " ms" << std::endl;
+  if (stats.nodes_quit == config.nodes)
+    std::cout << "completed after: " << ms(stats.completion) << " ms"
+              << std::endl;
+  else
+    std::cout << "did not complete within " << config.deadline << " s"
+              << std::endl;
+  std::cout << stats.events << " events in " << wall.count() << " s"
+            << std::endl;
+}
+
+CAF_MAIN();
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include <caf/all.hpp>
+
+#include "local_transport.hpp"
+
+using namespace caf;
+
+namespace {
+
+// -----------------------------------------------------------------------------
+//  ACTOR SYSTEM CONFIG
+// -----------------------------------------------------------------------------
+
+class configuration : public actor_system_config {
+public:
+  std::string transport = "all";
+  std::string role = "both";
+  std::string host = "localhost";
+  uint16_t port = 12400;
+  uint16_t offset = 0;
+  uint32_t size = 64;
+  uint32_t rounds = 100000;
+  uint32_t messages = 1000000;
+  uint32_t batch_size = 32;
+  uint32_t flush_us = 100;
+  configuration() {
+    opt_group{custom_options_,         "global"}
+      .add(transport,  "transport,T",  "shm, udp, mmsg (batched UDP), tcp, "
+                                       "auto (pick by host) or all")
+      .add(role,       "role,R",       "both (two threads), echo or measure "
+                                       "(one process each, start echo first)")
+      .add(host,       "host,H",       "host of the peer for --transport=auto")
+      .add(port,       "port,P",       "first loopback port for sockets")
+      .add(offset,     "offset,O",     "set offset for ports (for repeated "
+                                       "local testing)")
+      .add(size,       "size,s",       "message size in bytes")
+      .add(rounds,     "rounds,r",     "round trips for the latency test")
+      .add(messages,   "messages,m",   "messages for the throughput test")
+      .add(batch_size, "batch-size,b", "datagrams per sendmmsg/recvmmsg call "
+                                       "for mmsg")
+      .add(flush_us,   "flush-us,f",   "time (us) mmsg may hold back a "
+                                       "partial batch");
+  }
+};
+
+// -----------------------------------------------------------------------------
+//  BENCHMARK
+// -----------------------------------------------------------------------------
+
+/// The first byte of each message tells the echo side what to do.
+enum message_type : char {
+  ping_msg,
+  data_msg,
+  end_msg,
+  quit_msg
+};
+
+using clock_type = std::chrono::steady_clock;
+
+/// Answers pings, counts data and reports the count on each end marker.
+/// Stops on a quit message or, since a datagram may get lost, when idle
+/// after the first end marker.
+void echo(local_link& link) {
+  std::vector<char> buf(local_link::max_message_size);
+  uint64_t received = 0;
+  auto done = false;
+  for (;;) {
+    auto len = link.receive(buf.data());
+    if (len == 0) {
+      if (done)
+        return;
+      continue;
+    }
+    switch (buf[0]) {
+      case ping_msg:
+        link.send(buf.data(), len);
+        break;
+      case data_msg:
+        ++received;
+        break;
+      case end_msg:
+        memcpy(buf.data() + 1, &received, sizeof(received));
+        link.send(buf.data(), 1 + sizeof(received));
+        done = true;
+        break;
+      default:
+        return;
+    }
+  }
+}
+
+struct result {
+  std::vector<double> rtts_us;
+  uint32_t lost_pings = 0;
+  uint64_t delivered = 0;
+  double secs = 0.;
+  /// Syscalls of both sides during the throughput test per message sent.
+  double syscalls_per_msg = 0.;
+};
+
+/// Runs both tests over `link`. `peer` is the other end if it runs in this
+/// process, which only needs to count its syscalls.
+result run(local_link& link, const local_link* peer,
+           const configuration& config) {
+  result res;
+  std::vector<char> msg(config.size);
+  std::vector<char> buf(local_link::max_message_size);
+  msg[0] = ping_msg;
+  // Wait until the echo side answers, it may not have opened its end yet.
+  do
+    link.send(msg.data(), msg.size());
+  while (link.receive(buf.data()) != msg.size());
+  res.rtts_us.reserve(config.rounds);
+  for (uint32_t i = 0; i < config.rounds; ++i) {
+    auto t0 = clock_type::now();
+    link.send(msg.data(), msg.size());
+    if (link.receive(buf.data()) != msg.size()) {
+      ++res.lost_pings;
+      continue;
+    }
+    std::chrono::duration<double, std::micro> rtt = clock_type::now() - t0;
+    res.rtts_us.push_back(rtt.count());
+  }
+  std::sort(res.rtts_us.begin(), res.rtts_us.end());
+  msg[0] = data_msg;
+  auto peer_syscalls = [&] {
+    return peer != nullptr ? peer->syscalls() : 0;
+  };
+  auto syscalls = link.syscalls() + peer_syscalls();
+  auto t0 = clock_type::now();
+  for (uint32_t i = 0; i < config.messages; ++i)
+    link.send(msg.data(), msg.size());
+  // Datagrams may get lost, so repeat the end marker until the count
+  // arrives.
+  char end = end_msg;
+  do
+    link.send(&end, 1);
+  while (link.receive(buf.data()) != 1 + sizeof(res.delivered)
+         || buf[0] != end_msg);
+  std::chrono::duration<double> secs = clock_type::now() - t0;
+  memcpy(&res.delivered, buf.data() + 1, sizeof(res.delivered));
+  res.secs = secs.count();
+  if (config.messages > 0)
+    res.syscalls_per_msg = static_cast<double>(link.syscalls()
+                                               + peer_syscalls() - syscalls)
+                           / config.messages;
+  char quit = quit_msg;
+  link.send(&quit, 1);
+  link.flush();
+  return res;
+}
+
+double percentile(const std::vector<double>& xs, double q) {
+  if (xs.empty())
+    return 0.;
+  return xs[static_cast<size_t>(q * static_cast<double>(xs.size() - 1) + .5)];
+}
+
+} // namespace anonymous
+
+void caf_main(actor_system&, const configuration& config) {
+  std::vector<transport_kind> kinds;
+  if (config.transport == "all")
+    kinds = {transport_kind::shm, transport_kind::udp,
+             transport_kind::udp_batch, transport_kind::tcp};
+  else if (config.transport == "auto")
+    kinds = {choose_transport(config.host, true)};
+  else if (config.transport == "shm")
+    kinds = {transport_kind::shm};
+  else if (config.transport == "udp")
+    kinds = {transport_kind::udp};
+  else if (config.transport == "mmsg")
+    kinds = {transport_kind::udp_batch};
+  else if (config.transport == "tcp")
+    kinds = {transport_kind::tcp};
+  if (kinds.empty()) {
+    std::cerr << "Unknown transport: " << config.transport << std::endl;
+    return;
+  }
+  if (config.role != "both" && config.role != "echo"
+      && config.role != "measure") {
+    std::cerr << "Unknown role: " << config.role << std::endl;
+    return;
+  }
+  if (config.size < 16 || config.size > local_link::max_message_size) {
+    std::cerr << "Message size must be between 16 and "
+              << local_link::max_message_size << " bytes" << std::endl;
+    return;
+  }
+  std::cout << "Config: \n > transport = " << config.transport << std::endl
+            << " > role = " << config.role << std::endl
+            << " > host = " << config.host << std::endl
+            << " > port = " << config.port + config.offset << std::endl
+            << " > size = " << config.size << std::endl
+            << " > rounds = " << config.rounds << std::endl
+            << " > messages = " << config.messages << std::endl
+            << " > batch-size = " << config.batch_size << std::endl
+            << " > flush-us = " << config.flush_us << std::endl;
+  if (config.role != "echo")
+    std::cout << std::endl << std::setw(5) << "" << std::setw(12) << "p50 us"
+              << std::setw(12) << "p99 us" << std::setw(10) << "lost"
+              << std::setw(14) << "msgs/s" << std::setw(10) << "MB/s"
+              << std::setw(10) << "loss %" << std::setw(10) << "sys/msg"
+              << std::endl;
+  auto port = static_cast<uint16_t>(config.port + config.offset);
+  auto flush_interval = std::chrono::microseconds(config.flush_us);
+  for (auto kind : kinds) {
+    std::unique_ptr<local_link> a;
+    std::unique_ptr<local_link> b;
+    result res;
+    if (config.role == "both") {
+      if (!make_link_pair(kind, port, a, b, config.batch_size,
+                          flush_interval)) {
+        std::cerr << "Could not open " << to_string(kind) << " link"
+                  << std::endl;
+        continue;
+      }
+      std::thread peer{[&] { echo(*b); }};
+      res = run(*a, b.get(), config);
+      peer.join();
+    } else {
+      // With one process per end, both go through the kinds in the same
+      // order and the echo side opens each link first.
+      auto side = config.role == "echo" ? link_side::listen
+                                        : link_side::connect;
+      a = open_link(kind, port, side, config.batch_size, flush_interval);
+      if (!a) {
+        std::cerr << "Could not open " << to_string(kind) << " link"
+                  << std::endl;
+        continue;
+      }
+      if (side == link_side::listen) {
+        echo(*a);
+        std::cout << "echoed over " << to_string(kind) << std::endl;
+        continue;
+      }
+      res = run(*a, nullptr, config);
+    }
+    auto rate = res.secs > 0. ? static_cast<double>(res.delivered) / res.secs
+                              : 0.;
+    auto loss = config.messages > 0
+                ? 100. * (1. - static_cast<double>(res.delivered)
+                                 / static_cast<double>(config.messages))
+                : 0.;
+    std::cout << std::setw(5) << to_string(kind) << std::fixed
+              << std::setprecision(2) << std::setw(12)
+              << percentile(res.rtts_us, .5) << std::setw(12)
+              << percentile(res.rtts_us, .99) << std::setw(10)
+              << res.lost_pings << std::setprecision(0) << std::setw(14)
+              << rate << std::setprecision(1) << std::setw(10)
+              << rate * config.size / 1e6 << std::setw(10) << loss
+              << std::setprecision(2) << std::setw(10) << res.syscalls_per_msg
+              << std::endl;
+  }
+}
+
+CAF_MAIN();